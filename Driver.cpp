@@ -1,8 +1,37 @@
+#include "examples/Bench.hpp"
 #include <Poly/Poly.hpp>
+#include <Poly/LazyPoly.hpp>
+#include <Poly/Views.hpp>
+#include <array>
 #include <optional>
+#include <span>
 #include <cstdio>
+#include <cstdlib>
 #include <expected>
 
+//=== Checks ===//
+
+/// Like `assert`, but kept in release builds.
+#define CHECK(...) ((__VA_ARGS__) ? void(0) \
+  : checkFailed(#__VA_ARGS__, __LINE__))
+
+[[noreturn]] static void checkFailed(const char* Expr, int Line) {
+  std::fprintf(stderr, "Driver.cpp:%d: check failed: %s\n", Line, Expr);
+  std::abort();
+}
+
+//=== Allocation Tracking ===//
+
+/// Asserts no global allocations happen during its lifetime.
+struct NoAllocScope {
+  NoAllocScope() : start_(bench::allocs()) {}
+  ~NoAllocScope() { CHECK(bench::allocs() == start_); }
+private:
+  std::size_t start_;
+};
+
+//=== Alternative Sets ===//
+
 struct MyBase {
   virtual ~MyBase() {}
   virtual void saySomething() = 0;
@@ -18,28 +47,95 @@ struct Woofer : public MyBase {
 
 using MyPoly = efl::Poly<MyBase, Meower, Woofer>;
 
+struct PodBase { int tag = 0; };
+struct PodA : PodBase { int a[2] {}; };
+struct PodB : PodBase { double b = 0.0; };
+struct alignas(32) PodC : PodBase { float c[8] {}; };
+
+using PodPoly = efl::Poly<PodBase, PodA, PodB, PodC>;
+
+/// Deferring a copy of this throws.
+struct ThrowOnCopy {
+  ThrowOnCopy() = default;
+  ThrowOnCopy(const ThrowOnCopy&) { throw 0; }
+};
+
+struct PodD : PodBase {
+  PodD() = default;
+  explicit PodD(const ThrowOnCopy&) {}
+};
+
+template <typename P, typename A, typename B>
+static void checkNoAlloc() {
+  NoAllocScope S {};
+  P x;
+  x = A();
+  P y = x;
+  P z = std::move(y);
+  CHECK(z.template holdsType<A>() && y.isEmpty());
+  y = B();
+  int Seen = 0;
+  y.visit([&Seen] <typename T> (T*) { ++Seen; });
+  std::as_const(z).visit([&Seen] <typename T> (const T*) { ++Seen; });
+  CHECK(Seen == 2);
+  CHECK(&y.template get<B>() == &y.template getUnchecked<B>());
+  CHECK(std::as_const(y).template getIf<A>() == nullptr);
+  y.swap(z);
+  std::swap(x, z);
+  CHECK(x.template holdsType<B>() && z.template holdsType<A>());
+  x = A();
+  swap(x, z);
+  P e;
+  e.swap(x);
+  CHECK(x.isEmpty() && e.template holdsType<A>());
+  swap(e, x);
+  CHECK(e.isEmpty() && x.template holdsType<A>());
+  z = B();
+
+  std::optional<P> O;
+  O = z.take();
+  std::array<P, 4> Arr {};
+  for (auto& E : Arr)
+    E = P(*O);
+  Arr[1] = A();
+  std::swap(Arr[0], Arr[1]);
+  CHECK(Arr[0].template holdsType<A>());
+}
+
 int main() {
+  {
+    // Ensure the counters are actually hooked up.
+    const auto Before = bench::allocs();
+    delete new int(0);
+    CHECK(bench::allocs() == Before + 1);
+  }
+
+  NoAllocScope S {};
   MyPoly x;
-  assert(x.isEmpty());
+  CHECK(x.isEmpty());
   x = Meower();
   x->saySomething();
   x = Woofer();
   x->saySomething();
-  assert(x.holdsType<Woofer>());
-  
+  CHECK(x.holdsType<Woofer>());
+  CHECK(x.getIf<Meower>() == nullptr);
+  CHECK(x.typeId() == MyPoly::IdOf<Woofer>() && MyPoly::Size() == 3);
+  if (Woofer* W = x.getIf<Woofer>())
+    CHECK(W == &x.get<Woofer>());
+
   MyPoly y = x;
-  assert(y.holdsAny());
+  CHECK(y.holdsAny());
   Meower M {};
   y = M;
-  assert(y.holdsType<Meower>());
+  CHECK(y.holdsType<Meower>());
   y->saySomething();
 
   MyPoly z = std::move(x);
-  assert(z.holdsType<Woofer>() && x.isEmpty());
+  CHECK(z.holdsType<Woofer>() && x.isEmpty());
   z->saySomething();
 
   std::optional<MyPoly> O;
-  assert(!O.has_value());
+  CHECK(!O.has_value());
   O = Meower();
   (*O)->saySomething();
 
@@ -49,9 +145,66 @@ int main() {
   x->saySomething();
 
   x = z.take();
-  assert(z.isEmpty());
-  assert(x.holdsType<Meower>());
+  CHECK(z.isEmpty());
+  CHECK(x.holdsType<Meower>());
   z = Woofer();
   std::swap(x, z);
-  assert(x.holdsType<Woofer>());
-}
\ No newline at end of file
+  CHECK(x.holdsType<Woofer>());
+
+  std::array<MyPoly, 4> Pets { Meower(), Woofer(), MyPoly(), Meower() };
+  int Meowers = 0;
+  for (Meower& C : Pets | efl::views::of_type<Meower>) {
+    C.saySomething();
+    ++Meowers;
+  }
+  CHECK(Meowers == 2);
+  int Woofs = 0;
+  for (int W : std::span(Pets).first(2) | efl::views::visit(
+      [] <typename T> (T*) { return int(std::same_as<T, Woofer>); }))
+    Woofs += W;
+  CHECK(Woofs == 1);
+  int Visits = 0;
+  for (MyBase& B : Pets | efl::views::visit(
+      [] (MyBase* P) -> MyBase& { return *P; })) {
+    CHECK(&B == Pets[Visits == 2 ? 3 : Visits].operator->());
+    ++Visits;
+  }
+  CHECK(Visits == 3);
+
+  int Order = 0, Cats = 0, Visited = 0;
+  Pets[1].visitFused(
+    [&Order] <typename T> (T*) { Order = Order * 10 + 1; },
+    [&Order] <typename T> (T*) { Order = Order * 10 + 2; });
+  CHECK(Order == 12);
+  std::as_const(Pets[2]).visitFused([&Order] (auto*) { Order = 0; });
+  CHECK(Order == 12);
+  efl::visitFused(Pets,
+    [&Cats] <typename T> (T*) { Cats += std::same_as<T, Meower>; },
+    [&Visited] (auto*) { ++Visited; });
+  CHECK(Cats == 2 && Visited == 3);
+
+  efl::LazyPoly<MyBase, Meower, Woofer> L {std::in_place_type<Woofer>};
+  CHECK(!L.isMaterialized());
+  auto L2 = L;
+  L->saySomething();
+  CHECK(L.isMaterialized() && (*L).holdsType<Woofer>());
+  L2.defer<Meower>();
+  L2.visit([] <typename T> (T*) { CHECK((std::same_as<T, Meower>)); });
+
+  efl::SyncLazyPoly<PodBase, PodA, PodB> SL {std::in_place_type<PodB>};
+  CHECK(!SL.isMaterialized() && (*SL).holdsType<PodB>());
+
+  efl::LazyPoly<PodBase, PodA, PodD> LT {std::in_place_type<PodA>};
+  const ThrowOnCopy Bad {};
+  bool Threw = false;
+  try {
+    LT.defer<PodD>(Bad);
+  } catch (int) {
+    Threw = true;
+  }
+  CHECK(Threw && LT.isMaterialized() && (*LT).isEmpty());
+
+  checkNoAlloc<MyPoly, Meower, Woofer>();
+  checkNoAlloc<PodPoly, PodA, PodC>();
+  checkNoAlloc<PodPoly, PodB, PodBase>();
+}
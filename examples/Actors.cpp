@@ -0,0 +1,243 @@
+//===- Actors.cpp ---------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Ping-pong and fan-out over efl::Actor. Messages live inline in the
+//  mailbox rings, so steady-state messaging does not allocate. The
+//  ping-pong is compared against threads exchanging boxed messages
+//  through mutex/condition-variable queues.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Actor.hpp>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Msg {};
+
+struct Ball : Msg {
+  std::uint32_t left;
+};
+
+struct Work : Msg {
+  std::uint64_t value;
+};
+
+struct Tick : Msg {};
+
+/// Retries a send into a full mailbox. Only safe while the receiver is
+/// being drained by another worker or the pool has spare threads.
+template <typename A, typename T>
+static void sendRetry(A& To, T M) {
+  while (!To.send(M))
+    std::this_thread::yield();
+}
+
+//=== Ping-pong ===//
+
+struct Player : efl::Actor<Player, Msg, Ball, Work> {
+  using Actor::Actor;
+
+  void receive(Ball& B) {
+    if (B.left == 0)
+      done->fetch_add(1, std::memory_order_release);
+    else
+      sendRetry(*peer, Ball{{}, B.left - 1});
+  }
+
+  void receive(Work&) {}
+
+  Player* peer = nullptr;
+  std::atomic<std::size_t>* done = nullptr;
+};
+
+//=== Fan-out ===//
+
+struct Sink : efl::Actor<Sink, Msg, Work, Tick> {
+  using Actor::Actor;
+
+  void receive(Work& W) {
+    sum += W.value;
+    if (++count == expected)
+      done->fetch_add(1, std::memory_order_release);
+  }
+
+  void receive(Tick&) {}
+
+  std::uint64_t sum = 0, count = 0, expected = 0;
+  std::atomic<std::size_t>* done = nullptr;
+};
+
+/// Sends `total` Work messages round-robin over the sinks, a chunk per
+/// activation. A full sink ends the chunk; the source re-ticks itself.
+struct Source : efl::Actor<Source, Msg, Tick> {
+  using Actor::Actor;
+
+  void receive(Tick&) {
+    for (std::size_t K = 0; K < 256 && sent < total; ++K, ++sent) {
+      if (!sinks[sent % sinks.size()]->send(Work{{}, sent}))
+        break;
+    }
+    if (sent < total)
+      sendRetry(*this, Tick{});
+  }
+
+  std::vector<std::unique_ptr<Sink>> sinks;
+  std::uint64_t sent = 0, total = 0;
+};
+
+//=== Locked Baseline ===//
+
+namespace locked {
+  struct Msg {
+    virtual ~Msg() = default;
+  };
+
+  struct Ball : Msg {
+    explicit Ball(std::uint32_t L) : left(L) {}
+    std::uint32_t left;
+  };
+
+  struct Mailbox {
+    void push(std::unique_ptr<Msg> M) {
+      {
+        std::lock_guard G {lock};
+        queue.push_back(std::move(M));
+      }
+      ready.notify_one();
+    }
+
+    std::unique_ptr<Msg> pop() {
+      std::unique_lock G {lock};
+      ready.wait(G, [this] { return !queue.empty(); });
+      auto M = std::move(queue.front());
+      queue.pop_front();
+      return M;
+    }
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::unique_ptr<Msg>> queue;
+  };
+
+  /// Two threads bouncing `Balls` balls `Hits` times each.
+  inline double pingPong(std::uint32_t Balls, std::uint32_t Hits) {
+    Mailbox A, B;
+    auto Play = [Balls] (Mailbox& In, Mailbox& Out) {
+      std::uint32_t Finished = 0;
+      while (Finished < Balls) {
+        auto M = In.pop();
+        auto* X = static_cast<Ball*>(M.get());
+        if (X->left == 0) {
+          ++Finished;
+          Out.push(std::make_unique<Ball>(0));
+        } else {
+          Out.push(std::make_unique<Ball>(X->left - 1));
+        }
+      }
+    };
+    const auto T0 = bench::Clock::now();
+    for (std::uint32_t K = 0; K < Balls; ++K)
+      A.push(std::make_unique<Ball>(Hits));
+    std::thread TA([&] { Play(A, B); });
+    std::thread TB([&] { Play(B, A); });
+    TA.join();
+    TB.join();
+    return bench::secondsSince(T0);
+  }
+} // namespace locked
+
+//=== Benchmark ===//
+
+static void waitFor(const std::atomic<std::size_t>& Done, std::size_t N) {
+  while (Done.load(std::memory_order_acquire) < N)
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+int main(int Argc, char** Argv) {
+  const std::uint32_t Hits = Argc > 1
+    ? std::uint32_t(std::strtoul(Argv[1], nullptr, 10)) : 200'000;
+  const unsigned Threads = std::max(2u, std::thread::hardware_concurrency());
+  const std::uint32_t Pairs = 4, Balls = 8;
+  std::printf("pool: %u workers\n", Threads);
+
+  {
+    auto Pool = std::make_unique<efl::ActorPool>(Threads);
+    std::vector<std::unique_ptr<Player>> Players;
+    std::atomic<std::size_t> Done {0};
+    for (std::uint32_t P = 0; P < Pairs * 2; ++P) {
+      Players.push_back(std::make_unique<Player>(*Pool, 64));
+      Players.back()->done = &Done;
+    }
+    for (std::uint32_t P = 0; P < Pairs; ++P) {
+      Players[2 * P]->peer = Players[2 * P + 1].get();
+      Players[2 * P + 1]->peer = Players[2 * P].get();
+    }
+    const auto T0 = bench::Clock::now();
+    for (std::uint32_t P = 0; P < Pairs; ++P)
+      for (std::uint32_t K = 0; K < Balls; ++K)
+        sendRetry(*Players[2 * P], Ball{{}, Hits});
+    const std::size_t Before = bench::allocs();
+    waitFor(Done, Pairs * Balls);
+    const double Secs = bench::secondsSince(T0);
+    const std::size_t Allocs = bench::allocs() - Before;
+    Pool.reset();
+    const double Msgs = double(Pairs) * Balls * (Hits + 1);
+    std::printf("%-22s %7.2f M msgs/s  allocations: %zu\n",
+      "ping-pong (actors)", Msgs / Secs / 1e6, Allocs);
+  }
+
+  {
+    const std::uint32_t LockedHits = Hits / 10;
+    const double Secs = locked::pingPong(Balls, LockedHits);
+    std::printf("%-22s %7.2f M msgs/s\n", "ping-pong (locked)",
+      double(Balls) * (LockedHits + 1) / Secs / 1e6);
+  }
+
+  {
+    auto Pool = std::make_unique<efl::ActorPool>(Threads);
+    const std::size_t Sinks = 64;
+    const std::uint64_t Total = std::uint64_t(Hits) * 32;
+    std::atomic<std::size_t> Done {0};
+    Source S {*Pool, 16};
+    for (std::size_t K = 0; K < Sinks; ++K) {
+      S.sinks.push_back(std::make_unique<Sink>(*Pool, 1024));
+      S.sinks.back()->expected = Total / Sinks;
+      S.sinks.back()->done = &Done;
+    }
+    S.total = Total;
+    const auto T0 = bench::Clock::now();
+    sendRetry(S, Tick{});
+    waitFor(Done, Sinks);
+    const double Secs = bench::secondsSince(T0);
+    Pool.reset();
+    std::uint64_t Sum = 0;
+    for (auto& K : S.sinks)
+      Sum += K->sum;
+    if (Sum != Total * (Total - 1) / 2) {
+      std::fprintf(stderr, "lost messages\n");
+      return 1;
+    }
+    std::printf("%-22s %7.2f M msgs/s\n", "fan-out (actors)",
+      double(Total) / Secs / 1e6);
+  }
+}
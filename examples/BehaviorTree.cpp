@@ -0,0 +1,394 @@
+//===- BehaviorTree.cpp ---------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A behavior-tree runtime where a tree compiles into a flat,
+//  depth-first array of Poly nodes. Every node records where its
+//  subtree ends, so composites step over children and skip subtrees by
+//  index. Agents share the tree and keep only a blackboard and a small
+//  state row. Compares against per-agent trees of virtual nodes.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <memory>
+#include <vector>
+
+namespace bt {
+  enum class Status : std::uint8_t { Success, Failure, Running };
+
+  struct Blackboard {
+    float health, enemyDist, ammo;
+    std::uint32_t actions = 0;
+  };
+
+  enum class Field : std::uint8_t { Health, EnemyDist, Ammo };
+  enum class Cmp : std::uint8_t { Less, Greater };
+  enum class Act : std::uint8_t { Retreat, Shoot, Reload, Approach };
+
+  inline float read(const Blackboard& B, Field F) {
+    switch (F) {
+     case Field::Health:    return B.health;
+     case Field::EnemyDist: return B.enemyDist;
+     default:               return B.ammo;
+    }
+  }
+
+  inline bool test(const Blackboard& B, Field F, Cmp C, float V) {
+    const float X = read(B, F);
+    return C == Cmp::Less ? X < V : X > V;
+  }
+
+  /// Applies a finished action to the blackboard.
+  inline void apply(Blackboard& B, Act A) {
+    ++B.actions;
+    switch (A) {
+     case Act::Retreat:
+      B.enemyDist += 6;
+      B.health += 4;
+      break;
+     case Act::Shoot:
+      B.ammo -= 1;
+      B.health -= 3;
+      B.enemyDist += 1;
+      break;
+     case Act::Reload:
+      B.ammo = 8;
+      break;
+     case Act::Approach:
+      B.enemyDist -= 4;
+      break;
+    }
+  }
+
+  //=== Nodes ===//
+
+  /// `end` is one past the last node of this node's subtree.
+  struct BTNode {
+    std::uint32_t end = 0;
+  };
+
+  struct Sequence : BTNode {};
+  struct Selector : BTNode {};
+  struct Inverter : BTNode {};
+
+  struct Condition : BTNode {
+    Field field;
+    Cmp cmp;
+    float value;
+  };
+
+  /// Runs for `duration` ticks. Progress lives in the agent's state row
+  /// at `slot`.
+  struct Action : BTNode {
+    Act act;
+    std::uint16_t duration;
+    std::uint16_t slot;
+  };
+
+  using NodePoly = efl::Poly<BTNode,
+    Sequence, Selector, Inverter, Condition, Action>;
+
+  class Tree {
+    friend class TreeBuilder;
+  public:
+    std::size_t slots() const { return slots_; }
+    std::size_t size() const { return nodes_.size(); }
+    const NodePoly& operator[](std::size_t I) const { return nodes_[I]; }
+
+    Status tick(Blackboard& B, std::uint16_t* State) const {
+      return this->tick(0, B, State);
+    }
+
+  private:
+    Status tick(std::uint32_t I, Blackboard& B, std::uint16_t* State) const {
+      Status S = Status::Failure;
+      nodes_[I].visit([&] <typename T> (const T* N) {
+        S = this->run(*N, I, B, State);
+      });
+      return S;
+    }
+
+    Status run(const BTNode&, std::uint32_t, Blackboard&,
+               std::uint16_t*) const {
+      return Status::Failure;
+    }
+
+    Status run(const Sequence& N, std::uint32_t I, Blackboard& B,
+               std::uint16_t* State) const {
+      for (std::uint32_t K = I + 1; K < N.end; K = nodes_[K]->end) {
+        const Status S = this->tick(K, B, State);
+        if (S != Status::Success)
+          return S;
+      }
+      return Status::Success;
+    }
+
+    Status run(const Selector& N, std::uint32_t I, Blackboard& B,
+               std::uint16_t* State) const {
+      for (std::uint32_t K = I + 1; K < N.end; K = nodes_[K]->end) {
+        const Status S = this->tick(K, B, State);
+        if (S != Status::Failure)
+          return S;
+      }
+      return Status::Failure;
+    }
+
+    Status run(const Inverter&, std::uint32_t I, Blackboard& B,
+               std::uint16_t* State) const {
+      const Status S = this->tick(I + 1, B, State);
+      return S == Status::Running ? S
+        : (S == Status::Success ? Status::Failure : Status::Success);
+    }
+
+    Status run(const Condition& N, std::uint32_t, Blackboard& B,
+               std::uint16_t*) const {
+      return test(B, N.field, N.cmp, N.value)
+        ? Status::Success : Status::Failure;
+    }
+
+    Status run(const Action& N, std::uint32_t, Blackboard& B,
+               std::uint16_t* State) const {
+      if (++State[N.slot] < N.duration)
+        return Status::Running;
+      State[N.slot] = 0;
+      apply(B, N.act);
+      return Status::Success;
+    }
+
+    std::vector<NodePoly> nodes_;
+    std::size_t slots_ = 0;
+  };
+
+  /// Compiles nested builder calls into depth-first order.
+  class TreeBuilder {
+  public:
+    template <typename F>
+    TreeBuilder& sequence(F&& Children) {
+      return this->composite(Sequence{}, Children);
+    }
+
+    template <typename F>
+    TreeBuilder& selector(F&& Children) {
+      return this->composite(Selector{}, Children);
+    }
+
+    template <typename F>
+    TreeBuilder& inverter(F&& Child) {
+      return this->composite(Inverter{}, Child);
+    }
+
+    TreeBuilder& condition(Field F, Cmp C, float V) {
+      const auto I = std::uint32_t(tree_.nodes_.size());
+      tree_.nodes_.emplace_back(Condition{{I + 1}, F, C, V});
+      return *this;
+    }
+
+    TreeBuilder& action(Act A, std::uint16_t Duration) {
+      const auto I = std::uint32_t(tree_.nodes_.size());
+      const auto Slot = std::uint16_t(tree_.slots_++);
+      tree_.nodes_.emplace_back(Action{{I + 1}, A, Duration, Slot});
+      return *this;
+    }
+
+    Tree build() { return std::move(tree_); }
+
+  private:
+    template <typename T, typename F>
+    TreeBuilder& composite(T Node, F& Children) {
+      const std::size_t I = tree_.nodes_.size();
+      tree_.nodes_.emplace_back(Node);
+      Children();
+      tree_.nodes_[I]->end = std::uint32_t(tree_.nodes_.size());
+      return *this;
+    }
+
+    Tree tree_;
+  };
+} // namespace bt
+
+//=== Virtual Baseline ===//
+
+namespace boxed {
+  using bt::Blackboard;
+  using bt::Status;
+
+  struct Node {
+    virtual ~Node() = default;
+    virtual Status tick(Blackboard& B) = 0;
+  };
+
+  struct Sequence : Node {
+    Status tick(Blackboard& B) override {
+      for (auto& C : children) {
+        const Status S = C->tick(B);
+        if (S != Status::Success)
+          return S;
+      }
+      return Status::Success;
+    }
+    std::vector<std::unique_ptr<Node>> children;
+  };
+
+  struct Selector : Node {
+    Status tick(Blackboard& B) override {
+      for (auto& C : children) {
+        const Status S = C->tick(B);
+        if (S != Status::Failure)
+          return S;
+      }
+      return Status::Failure;
+    }
+    std::vector<std::unique_ptr<Node>> children;
+  };
+
+  struct Inverter : Node {
+    Status tick(Blackboard& B) override {
+      const Status S = child->tick(B);
+      return S == Status::Running ? S
+        : (S == Status::Success ? Status::Failure : Status::Success);
+    }
+    std::unique_ptr<Node> child;
+  };
+
+  struct Condition : Node {
+    explicit Condition(const bt::Condition& C) : node(C) {}
+    Status tick(Blackboard& B) override {
+      return bt::test(B, node.field, node.cmp, node.value)
+        ? Status::Success : Status::Failure;
+    }
+    bt::Condition node;
+  };
+
+  struct Action : Node {
+    explicit Action(const bt::Action& A) : node(A) {}
+    Status tick(Blackboard& B) override {
+      if (++progress < node.duration)
+        return Status::Running;
+      progress = 0;
+      bt::apply(B, node.act);
+      return Status::Success;
+    }
+    bt::Action node;
+    std::uint16_t progress = 0;
+  };
+
+  /// Rebuilds the subtree at `I` as heap-allocated virtual nodes.
+  inline std::unique_ptr<Node> clone(const bt::Tree& T, std::uint32_t I) {
+    std::unique_ptr<Node> Out;
+    auto Children = [&] (auto& C, std::uint32_t End) {
+      for (std::uint32_t K = I + 1; K < End; K = T[K]->end)
+        C.push_back(clone(T, K));
+    };
+    T[I].visit([&] <typename N> (const N* P) {
+      if constexpr (std::same_as<N, bt::Sequence>) {
+        auto S = std::make_unique<Sequence>();
+        Children(S->children, P->end);
+        Out = std::move(S);
+      } else if constexpr (std::same_as<N, bt::Selector>) {
+        auto S = std::make_unique<Selector>();
+        Children(S->children, P->end);
+        Out = std::move(S);
+      } else if constexpr (std::same_as<N, bt::Inverter>) {
+        auto S = std::make_unique<Inverter>();
+        S->child = clone(T, I + 1);
+        Out = std::move(S);
+      } else if constexpr (std::same_as<N, bt::Condition>) {
+        Out = std::make_unique<Condition>(*P);
+      } else if constexpr (std::same_as<N, bt::Action>) {
+        Out = std::make_unique<Action>(*P);
+      }
+    });
+    return Out;
+  }
+} // namespace boxed
+
+//=== Benchmark ===//
+
+static bt::Tree makeSoldier() {
+  using namespace bt;
+  TreeBuilder B;
+  B.selector([&] {
+    B.sequence([&] {
+      B.condition(Field::Health, Cmp::Less, 25);
+      B.action(Act::Retreat, 3);
+    });
+    B.sequence([&] {
+      B.condition(Field::EnemyDist, Cmp::Less, 10);
+      B.condition(Field::Ammo, Cmp::Greater, 0);
+      B.action(Act::Shoot, 1);
+    });
+    B.sequence([&] {
+      B.inverter([&] { B.condition(Field::Ammo, Cmp::Greater, 0); });
+      B.action(Act::Reload, 2);
+    });
+    B.action(Act::Approach, 2);
+  });
+  return B.build();
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t Agents = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 20'000;
+  const std::size_t Ticks = 200;
+
+  const bt::Tree Tree = makeSoldier();
+  bench::Rng R;
+  std::vector<bt::Blackboard> Boards(Agents);
+  for (auto& B : Boards)
+    B = {20.0f + float(R.below(80)), float(R.below(40)), float(R.below(9))};
+  std::vector<bt::Blackboard> BoxBoards = Boards;
+
+  // Flat tree: boards plus one state row per agent.
+  std::vector<std::uint16_t> State(Agents * Tree.slots());
+  const auto T0 = bench::Clock::now();
+  for (std::size_t T = 0; T < Ticks; ++T)
+    for (std::size_t A = 0; A < Agents; ++A)
+      (void) Tree.tick(Boards[A], State.data() + A * Tree.slots());
+  const double FlatSecs = bench::secondsSince(T0);
+
+  // Baseline: a heap tree per agent, interleaved as agents spawn.
+  std::vector<std::unique_ptr<boxed::Node>> Trees;
+  std::vector<std::unique_ptr<char[]>> Scatter;
+  for (std::size_t A = 0; A < Agents; ++A) {
+    Trees.push_back(boxed::clone(Tree, 0));
+    Scatter.push_back(std::make_unique<char[]>(32 + R.below(512)));
+  }
+  const auto T1 = bench::Clock::now();
+  for (std::size_t T = 0; T < Ticks; ++T)
+    for (std::size_t A = 0; A < Agents; ++A)
+      (void) Trees[A]->tick(BoxBoards[A]);
+  const double BoxSecs = bench::secondsSince(T1);
+
+  std::uint64_t Actions = 0;
+  for (std::size_t A = 0; A < Agents; ++A) {
+    if (Boards[A].actions != BoxBoards[A].actions
+        || Boards[A].health != BoxBoards[A].health) {
+      std::fprintf(stderr, "agent %zu diverged\n", A);
+      return 1;
+    }
+    Actions += Boards[A].actions;
+  }
+  const double Total = double(Agents) * Ticks;
+  std::printf("agents: %zu x %zu ticks, %zu nodes, %llu actions\n",
+    Agents, Ticks, Tree.size(), (unsigned long long)Actions);
+  std::printf("%-14s %9.0f agents/ms\n", "flat poly",
+    Total / FlatSecs / 1e3);
+  std::printf("%-14s %9.0f agents/ms\n", "virtual nodes",
+    Total / BoxSecs / 1e3);
+}
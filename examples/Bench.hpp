@@ -0,0 +1,162 @@
+//===- Bench.hpp ----------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Shared helpers for the example benchmarks and the driver. Include
+//  from exactly one translation unit per executable, as it replaces
+//  global operator new.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace bench {
+  inline std::atomic<std::size_t> AllocCount {0};
+
+  inline void* countedAlloc(std::size_t N) {
+    AllocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* P = std::malloc(N ? N : 1))
+      return P;
+    throw std::bad_alloc();
+  }
+
+  inline void* countedAlloc(std::size_t N, std::align_val_t A) {
+    AllocCount.fetch_add(1, std::memory_order_relaxed);
+    const auto Align = static_cast<std::size_t>(A);
+    const auto Size = ((N ? N : 1) + Align - 1) & ~(Align - 1);
+    if (void* P = std::aligned_alloc(Align, Size))
+      return P;
+    throw std::bad_alloc();
+  }
+
+  inline std::size_t allocs() noexcept {
+    return AllocCount.load(std::memory_order_relaxed);
+  }
+
+  using Clock = std::chrono::steady_clock;
+
+  inline double secondsSince(Clock::time_point T) noexcept {
+    return std::chrono::duration<double>(Clock::now() - T).count();
+  }
+
+  /// Keeps `V` alive through the optimizer.
+  template <typename T>
+  inline void doNotOptimize(const T& V) noexcept {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(V) : "memory");
+#else
+    static volatile const T* Sink;
+    Sink = &V;
+#endif
+  }
+
+  /// Prints median/p99/p99.9 of a set of nanosecond samples.
+  inline void printLatency(const char* Name, std::vector<std::uint64_t>& Ns) {
+    if (Ns.empty())
+      return;
+    std::sort(Ns.begin(), Ns.end());
+    auto At = [&Ns] (double Q) {
+      return Ns[std::min(Ns.size() - 1, std::size_t(Q * Ns.size()))];
+    };
+    std::printf("%-20s median %6llu ns  p99 %6llu ns  p99.9 %6llu ns\n",
+      Name, (unsigned long long)At(0.5),
+      (unsigned long long)At(0.99), (unsigned long long)At(0.999));
+  }
+
+  /// Small deterministic generator so runs are reproducible.
+  struct Rng {
+    std::uint64_t state = 0x9E3779B97F4A7C15ull;
+    std::uint64_t next() noexcept {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      return state;
+    }
+    std::uint32_t below(std::uint32_t N) noexcept {
+      return std::uint32_t((next() >> 32) * N >> 32);
+    }
+    double unit() noexcept {
+      return double(next() >> 11) * 0x1.0p-53;
+    }
+  };
+} // namespace bench
+
+void* operator new(std::size_t N) { return bench::countedAlloc(N); }
+void* operator new[](std::size_t N) { return bench::countedAlloc(N); }
+void* operator new(std::size_t N, std::align_val_t A) {
+  return bench::countedAlloc(N, A);
+}
+void* operator new[](std::size_t N, std::align_val_t A) {
+  return bench::countedAlloc(N, A);
+}
+void* operator new(std::size_t N, const std::nothrow_t&) noexcept {
+  try {
+    return bench::countedAlloc(N);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new[](std::size_t N, const std::nothrow_t& T) noexcept {
+  return ::operator new(N, T);
+}
+void* operator new(std::size_t N, std::align_val_t A,
+                   const std::nothrow_t&) noexcept {
+  try {
+    return bench::countedAlloc(N, A);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new[](std::size_t N, std::align_val_t A,
+                     const std::nothrow_t& T) noexcept {
+  return ::operator new(N, A, T);
+}
+void operator delete(void* P) noexcept { std::free(P); }
+void operator delete[](void* P) noexcept { std::free(P); }
+void operator delete(void* P, std::size_t) noexcept { std::free(P); }
+void operator delete[](void* P, std::size_t) noexcept { std::free(P); }
+void operator delete(void* P, std::align_val_t) noexcept { std::free(P); }
+void operator delete[](void* P, std::align_val_t) noexcept { std::free(P); }
+void operator delete(void* P, std::size_t, std::align_val_t) noexcept {
+  std::free(P);
+}
+void operator delete[](void* P, std::size_t, std::align_val_t) noexcept {
+  std::free(P);
+}
+void operator delete(void* P, const std::nothrow_t&) noexcept {
+  std::free(P);
+}
+void operator delete[](void* P, const std::nothrow_t&) noexcept {
+  std::free(P);
+}
+void operator delete(void* P, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  std::free(P);
+}
+void operator delete[](void* P, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  std::free(P);
+}
@@ -0,0 +1,587 @@
+//===- Collision.cpp ------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A collision pipeline over inline Poly shapes. Shapes are kept sorted
+//  by alternative, a uniform-grid broadphase emits candidate pairs,
+//  and the narrow phase buckets pairs by (idA, idB) before running each
+//  bucket through a constexpr table of batch kernels. Compares against
+//  virtual double dispatch over boxed shapes.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+struct Vec3 {
+  float x = 0, y = 0, z = 0;
+};
+
+inline Vec3 operator+(Vec3 A, Vec3 B) {
+  return {A.x + B.x, A.y + B.y, A.z + B.z};
+}
+inline Vec3 operator-(Vec3 A, Vec3 B) {
+  return {A.x - B.x, A.y - B.y, A.z - B.z};
+}
+inline Vec3 operator-(Vec3 A) { return {-A.x, -A.y, -A.z}; }
+inline Vec3 operator*(Vec3 A, float S) { return {A.x * S, A.y * S, A.z * S}; }
+inline float dot(Vec3 A, Vec3 B) { return A.x * B.x + A.y * B.y + A.z * B.z; }
+inline Vec3 cross(Vec3 A, Vec3 B) {
+  return {A.y * B.z - A.z * B.y, A.z * B.x - A.x * B.z, A.x * B.y - A.y * B.x};
+}
+inline float clamp01(float V) { return V < 0 ? 0 : (V > 1 ? 1 : V); }
+
+inline Vec3 normalize(Vec3 V) {
+  const float L = dot(V, V);
+  return L > 1e-12f ? V * (1.0f / std::sqrt(L)) : Vec3{1, 0, 0};
+}
+
+//=== Shapes ===//
+
+struct Shape {};
+
+struct Sphere : Shape {
+  Vec3 c;
+  float r;
+};
+
+/// Axis-aligned box.
+struct Box : Shape {
+  Vec3 c, half;
+};
+
+struct Capsule : Shape {
+  Vec3 a, b;
+  float r;
+};
+
+struct ConvexHull : Shape {
+  static constexpr unsigned Max = 8;
+  Vec3 points[Max];
+  unsigned count;
+};
+
+using ShapePoly = efl::Poly<Shape, Sphere, Box, Capsule, ConvexHull>;
+
+inline Vec3 support(const Sphere& S, Vec3 D) {
+  return S.c + normalize(D) * S.r;
+}
+inline Vec3 support(const Box& B, Vec3 D) {
+  return {B.c.x + (D.x < 0 ? -B.half.x : B.half.x),
+          B.c.y + (D.y < 0 ? -B.half.y : B.half.y),
+          B.c.z + (D.z < 0 ? -B.half.z : B.half.z)};
+}
+inline Vec3 support(const Capsule& C, Vec3 D) {
+  return (dot(D, C.b - C.a) > 0 ? C.b : C.a) + normalize(D) * C.r;
+}
+inline Vec3 support(const ConvexHull& H, Vec3 D) {
+  Vec3 Best = H.points[0];
+  float Max = dot(Best, D);
+  for (unsigned I = 1; I < H.count; ++I) {
+    const float P = dot(H.points[I], D);
+    if (P > Max) {
+      Max = P;
+      Best = H.points[I];
+    }
+  }
+  return Best;
+}
+
+struct Bounds {
+  Vec3 lo, hi;
+};
+
+template <typename T>
+Bounds boundsOf(const T& S) {
+  return {{support(S, {-1, 0, 0}).x, support(S, {0, -1, 0}).y,
+           support(S, {0, 0, -1}).z},
+          {support(S, {1, 0, 0}).x, support(S, {0, 1, 0}).y,
+           support(S, {0, 0, 1}).z}};
+}
+
+//=== Narrow Phase Kernels ===//
+
+namespace gjk {
+  inline bool line(Vec3* S, int& N, Vec3& D) {
+    const Vec3 AB = S[1] - S[0], AO = -S[0];
+    if (dot(AB, AO) > 0) {
+      D = cross(cross(AB, AO), AB);
+    } else {
+      N = 1;
+      D = AO;
+    }
+    return dot(D, D) < 1e-12f;
+  }
+
+  inline bool triangle(Vec3* S, int& N, Vec3& D) {
+    const Vec3 A = S[0], B = S[1], C = S[2];
+    const Vec3 AB = B - A, AC = C - A, AO = -A;
+    const Vec3 ABC = cross(AB, AC);
+    if (dot(cross(ABC, AC), AO) > 0) {
+      if (dot(AC, AO) > 0) {
+        S[1] = C;
+        N = 2;
+        D = cross(cross(AC, AO), AC);
+        return dot(D, D) < 1e-12f;
+      }
+      N = 2;
+      return line(S, N, D);
+    }
+    if (dot(cross(AB, ABC), AO) > 0) {
+      N = 2;
+      return line(S, N, D);
+    }
+    if (dot(ABC, AO) > 0) {
+      D = ABC;
+    } else {
+      S[1] = C;
+      S[2] = B;
+      D = -ABC;
+    }
+    return dot(D, D) < 1e-12f;
+  }
+
+  inline bool tetrahedron(Vec3* S, int& N, Vec3& D) {
+    const Vec3 A = S[0], B = S[1], C = S[2], E = S[3];
+    const Vec3 AB = B - A, AC = C - A, AE = E - A, AO = -A;
+    if (dot(cross(AB, AC), AO) > 0) {
+      N = 3;
+      return triangle(S, N, D);
+    }
+    if (dot(cross(AC, AE), AO) > 0) {
+      S[1] = C;
+      S[2] = E;
+      N = 3;
+      return triangle(S, N, D);
+    }
+    if (dot(cross(AE, AB), AO) > 0) {
+      S[1] = E;
+      S[2] = B;
+      N = 3;
+      return triangle(S, N, D);
+    }
+    return true;
+  }
+
+  /// Boolean GJK over the Minkowski difference. Gives up after a fixed
+  /// number of steps and reports a hit, which is conservative.
+  template <typename A, typename B>
+  bool intersect(const A& X, const B& Y) {
+    auto Support = [&] (Vec3 D) { return support(X, D) - support(Y, -D); };
+    Vec3 S[4] {Support({1, 0, 0})};
+    int N = 1;
+    Vec3 D = -S[0];
+    for (int It = 0; It < 32; ++It) {
+      if (dot(D, D) < 1e-12f)
+        return true;
+      const Vec3 P = Support(D);
+      if (dot(P, D) < 0)
+        return false;
+      S[3] = S[2];
+      S[2] = S[1];
+      S[1] = S[0];
+      S[0] = P;
+      ++N;
+      const bool Hit = N == 2 ? line(S, N, D)
+        : N == 3 ? triangle(S, N, D) : tetrahedron(S, N, D);
+      if (Hit)
+        return true;
+    }
+    return true;
+  }
+} // namespace gjk
+
+inline float segmentDistSq(Vec3 P, Vec3 A, Vec3 B) {
+  const Vec3 AB = B - A;
+  const float L = dot(AB, AB);
+  const float T = L > 0 ? clamp01(dot(P - A, AB) / L) : 0;
+  const Vec3 Q = A + AB * T - P;
+  return dot(Q, Q);
+}
+
+/// Closest distance between two segments (Ericson, 5.1.9).
+inline float segmentSegmentDistSq(Vec3 P1, Vec3 Q1, Vec3 P2, Vec3 Q2) {
+  const Vec3 D1 = Q1 - P1, D2 = Q2 - P2, R = P1 - P2;
+  const float A = dot(D1, D1), E = dot(D2, D2), F = dot(D2, R);
+  float S = 0, T = 0;
+  if (A <= 1e-12f && E <= 1e-12f) {
+    return dot(R, R);
+  } else if (A <= 1e-12f) {
+    T = clamp01(F / E);
+  } else {
+    const float C = dot(D1, R);
+    if (E <= 1e-12f) {
+      S = clamp01(-C / A);
+    } else {
+      const float B = dot(D1, D2), Den = A * E - B * B;
+      S = Den != 0 ? clamp01((B * F - C * E) / Den) : 0;
+      T = (B * S + F) / E;
+      if (T < 0) {
+        T = 0;
+        S = clamp01(-C / A);
+      } else if (T > 1) {
+        T = 1;
+        S = clamp01((B - C) / A);
+      }
+    }
+  }
+  const Vec3 V = (P1 + D1 * S) - (P2 + D2 * T);
+  return dot(V, V);
+}
+
+inline bool collide(const Sphere& A, const Sphere& B) {
+  const Vec3 D = A.c - B.c;
+  const float R = A.r + B.r;
+  return dot(D, D) <= R * R;
+}
+
+inline bool collide(const Sphere& A, const Box& B) {
+  const Vec3 Lo = B.c - B.half, Hi = B.c + B.half;
+  const Vec3 Q {std::fmin(std::fmax(A.c.x, Lo.x), Hi.x),
+                std::fmin(std::fmax(A.c.y, Lo.y), Hi.y),
+                std::fmin(std::fmax(A.c.z, Lo.z), Hi.z)};
+  const Vec3 D = Q - A.c;
+  return dot(D, D) <= A.r * A.r;
+}
+
+inline bool collide(const Box& A, const Box& B) {
+  const Vec3 D = A.c - B.c;
+  return std::fabs(D.x) <= A.half.x + B.half.x
+    && std::fabs(D.y) <= A.half.y + B.half.y
+    && std::fabs(D.z) <= A.half.z + B.half.z;
+}
+
+inline bool collide(const Sphere& A, const Capsule& B) {
+  const float R = A.r + B.r;
+  return segmentDistSq(A.c, B.a, B.b) <= R * R;
+}
+
+inline bool collide(const Capsule& A, const Capsule& B) {
+  const float R = A.r + B.r;
+  return segmentSegmentDistSq(A.a, A.b, B.a, B.b) <= R * R;
+}
+
+/// Pairs without an analytic test go through GJK.
+template <typename A, typename B>
+bool collide(const A& X, const B& Y) {
+  return gjk::intersect(X, Y);
+}
+
+/// Orders the arguments by alternative id so each unordered pair has
+/// one kernel.
+template <typename A, typename B>
+bool collideAny(const A& X, const B& Y) {
+  if constexpr (ShapePoly::IdOf<A>() <= ShapePoly::IdOf<B>())
+    return collide(X, Y);
+  else
+    return collide(Y, X);
+}
+
+//=== Pipeline ===//
+
+struct Pair {
+  std::uint32_t a, b;
+};
+
+struct GridEntry {
+  std::uint64_t key;
+  std::uint32_t index;
+};
+
+/// Uniform grid keyed by each shape's lower corner. Cells are as wide
+/// as the largest shape, so overlapping shapes are always neighbours.
+inline void broadphase(const std::vector<Bounds>& B, std::vector<Pair>& Out,
+                       std::vector<GridEntry>& Grid) {
+  Out.clear();
+  Grid.clear();
+  if (B.empty())
+    return;
+  Vec3 Min = B[0].lo;
+  float Size = 1e-3f;
+  for (const Bounds& X : B) {
+    Min = {std::fmin(Min.x, X.lo.x), std::fmin(Min.y, X.lo.y),
+           std::fmin(Min.z, X.lo.z)};
+    const Vec3 E = X.hi - X.lo;
+    Size = std::fmax(Size, std::fmax(E.x, std::fmax(E.y, E.z)));
+  }
+  const float Inv = 1.0f / Size;
+  // Offset by one so the neighbour below cell zero does not wrap.
+  auto CellOf = [&] (const Bounds& X) {
+    return std::array<std::uint64_t, 3> {
+      std::uint64_t((X.lo.x - Min.x) * Inv) + 1,
+      std::uint64_t((X.lo.y - Min.y) * Inv) + 1,
+      std::uint64_t((X.lo.z - Min.z) * Inv) + 1};
+  };
+  auto Key = [] (std::uint64_t X, std::uint64_t Y, std::uint64_t Z) {
+    return (X << 42) | (Y << 21) | Z;
+  };
+
+  for (std::uint32_t I = 0; I < B.size(); ++I) {
+    const auto C = CellOf(B[I]);
+    Grid.push_back({Key(C[0], C[1], C[2]), I});
+  }
+  std::sort(Grid.begin(), Grid.end(), [] (const auto& L, const auto& R) {
+    return L.key < R.key;
+  });
+
+  for (std::uint32_t I = 0; I < B.size(); ++I) {
+    const Bounds& X = B[I];
+    const auto C = CellOf(X);
+    for (std::uint64_t DX = 0; DX < 3; ++DX)
+    for (std::uint64_t DY = 0; DY < 3; ++DY) {
+      const std::uint64_t Lo = Key(C[0] + DX - 1, C[1] + DY - 1, C[2] - 1);
+      const std::uint64_t Hi = Key(C[0] + DX - 1, C[1] + DY - 1, C[2] + 1);
+      auto It = std::lower_bound(Grid.begin(), Grid.end(), Lo,
+        [] (const GridEntry& E, std::uint64_t K) { return E.key < K; });
+      for (; It != Grid.end() && It->key <= Hi; ++It) {
+        const Bounds& Y = B[It->index];
+        if (It->index > I
+            && X.lo.x <= Y.hi.x && Y.lo.x <= X.hi.x
+            && X.lo.y <= Y.hi.y && Y.lo.y <= X.hi.y
+            && X.lo.z <= Y.hi.z && Y.lo.z <= X.hi.z)
+          Out.push_back({I, It->index});
+      }
+    }
+  }
+}
+
+inline constexpr std::size_t Ids = ShapePoly::Size() + 1;
+using BatchFn = std::size_t(*)(const ShapePoly*, const Pair*, std::size_t);
+
+template <typename A, typename B>
+std::size_t collideBatch(const ShapePoly* S, const Pair* P, std::size_t N) {
+  std::size_t Hits = 0;
+  for (std::size_t K = 0; K < N; ++K)
+    Hits += collide(S[P[K].a].getUnchecked<A>(), S[P[K].b].getUnchecked<B>());
+  return Hits;
+}
+
+template <typename...TT>
+struct ShapeList {
+  using Table = std::array<BatchFn, Ids * Ids>;
+
+  template <typename A>
+  static constexpr void fillRow(Table& T) {
+    ((ShapePoly::IdOf<A>() <= ShapePoly::IdOf<TT>()
+      ? void(T[ShapePoly::IdOf<A>() * Ids + ShapePoly::IdOf<TT>()]
+          = &collideBatch<A, TT>)
+      : void()), ...);
+  }
+
+  /// Indexed by `idA * Ids + idB` with `idA <= idB`.
+  static constexpr Table table() {
+    Table T {};
+    (fillRow<TT>(T), ...);
+    return T;
+  }
+};
+
+inline constexpr auto Kernels
+  = ShapeList<Sphere, Box, Capsule, ConvexHull>::table();
+
+/// Shapes sorted by alternative, with the scratch state of one step.
+class World {
+public:
+  explicit World(const std::vector<ShapePoly>& Scene) {
+    std::size_t Begin[Ids + 1] {};
+    for (const auto& S : Scene)
+      ++Begin[S.typeId() + 1];
+    for (std::size_t K = 1; K <= Ids; ++K)
+      Begin[K] += Begin[K - 1];
+    shapes_.resize(Scene.size());
+    for (const auto& S : Scene)
+      shapes_[Begin[S.typeId()]++] = ShapePoly(S);
+    bounds_.reserve(shapes_.size());
+    for (const auto& S : shapes_)
+      S.visit([this] <typename T> (const T* P) {
+        if constexpr (std::same_as<T, Shape>)
+          bounds_.push_back({});
+        else
+          bounds_.push_back(boundsOf(*P));
+      });
+  }
+
+  void findPairs() { broadphase(bounds_, pairs_, grid_); }
+
+  /// Buckets pairs by (idA, idB) and runs each bucket through its
+  /// kernel. Returns the number of contacts.
+  std::size_t narrowphase() {
+    std::size_t Count[Ids * Ids + 1] {};
+    for (Pair& P : pairs_) {
+      if (shapes_[P.a].typeId() > shapes_[P.b].typeId())
+        std::swap(P.a, P.b);
+      ++Count[this->keyOf(P) + 1];
+    }
+    for (std::size_t K = 1; K < std::size(Count); ++K)
+      Count[K] += Count[K - 1];
+    std::size_t Begin[Ids * Ids];
+    std::copy(Count, Count + Ids * Ids, Begin);
+    sorted_.resize(pairs_.size());
+    for (const Pair& P : pairs_)
+      sorted_[Count[this->keyOf(P)]++] = P;
+
+    std::size_t Hits = 0;
+    for (std::size_t K = 0; K < Ids * Ids; ++K) {
+      const std::size_t N = Count[K] - Begin[K];
+      if (N != 0 && Kernels[K])
+        Hits += Kernels[K](shapes_.data(), sorted_.data() + Begin[K], N);
+    }
+    return Hits;
+  }
+
+  std::size_t pairs() const { return pairs_.size(); }
+
+private:
+  std::size_t keyOf(const Pair& P) const {
+    return shapes_[P.a].typeId() * Ids + shapes_[P.b].typeId();
+  }
+
+  std::vector<ShapePoly> shapes_;
+  std::vector<Bounds> bounds_;
+  std::vector<Pair> pairs_, sorted_;
+  std::vector<GridEntry> grid_;
+};
+
+//=== Virtual Baseline ===//
+
+namespace boxed {
+  struct Shape {
+    virtual ~Shape() = default;
+    virtual bool collide(const Shape& O) const = 0;
+    virtual bool with(const Sphere& O) const = 0;
+    virtual bool with(const Box& O) const = 0;
+    virtual bool with(const Capsule& O) const = 0;
+    virtual bool with(const ConvexHull& O) const = 0;
+    Bounds bounds;
+  };
+
+  template <typename T>
+  struct Impl final : Shape {
+    explicit Impl(const T& S) : shape(S) { this->bounds = boundsOf(S); }
+    bool collide(const Shape& O) const override { return O.with(shape); }
+    bool with(const Sphere& O) const override { return collideAny(O, shape); }
+    bool with(const Box& O) const override { return collideAny(O, shape); }
+    bool with(const Capsule& O) const override { return collideAny(O, shape); }
+    bool with(const ConvexHull& O) const override {
+      return collideAny(O, shape);
+    }
+    T shape;
+  };
+} // namespace boxed
+
+//=== Benchmark ===//
+
+static std::vector<ShapePoly> makeScene(bench::Rng& R, std::size_t N) {
+  const float Extent = std::cbrt(float(N)) * 2.2f;
+  auto Point = [&] {
+    return Vec3{float(R.unit()) * Extent, float(R.unit()) * Extent,
+      float(R.unit()) * Extent};
+  };
+  auto Offset = [&] (float S) {
+    return Vec3{float(R.unit() - 0.5) * S, float(R.unit() - 0.5) * S,
+      float(R.unit() - 0.5) * S};
+  };
+  // Half-extents stay positive, in [0.2, 0.8).
+  auto HalfExtent = [&] {
+    return Vec3{0.2f + float(R.unit()) * 0.6f,
+      0.2f + float(R.unit()) * 0.6f, 0.2f + float(R.unit()) * 0.6f};
+  };
+  std::vector<ShapePoly> Scene;
+  Scene.reserve(N);
+  for (std::size_t I = 0; I < N; ++I) {
+    const Vec3 C = Point();
+    switch (R.below(4)) {
+     case 0:
+      Scene.emplace_back(Sphere{{}, C, 0.5f + float(R.unit()) * 0.5f});
+      break;
+     case 1:
+      Scene.emplace_back(Box{{}, C, HalfExtent()});
+      break;
+     case 2: {
+      const Vec3 D = Offset(2.0f);
+      Scene.emplace_back(Capsule{{}, C - D * 0.5f, C + D * 0.5f,
+        0.2f + float(R.unit()) * 0.3f});
+      break;
+     }
+     default: {
+      ConvexHull H {};
+      H.count = ConvexHull::Max;
+      for (auto& P : H.points)
+        P = C + Offset(1.5f);
+      Scene.emplace_back(H);
+      break;
+     }
+    }
+  }
+  return Scene;
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t N = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 50'000;
+  const int Scenes = 8;
+
+  bench::Rng R;
+  std::size_t Pairs = 0, PolyHits = 0, BoxHits = 0;
+  double BroadSecs = 0, PolySecs = 0, BoxSecs = 0;
+  std::vector<Pair> BoxPairs;
+  std::vector<Bounds> BoxBounds;
+  std::vector<GridEntry> Grid;
+  for (int K = 0; K < Scenes; ++K) {
+    const auto Scene = makeScene(R, N);
+
+    World W {Scene};
+    auto T0 = bench::Clock::now();
+    W.findPairs();
+    BroadSecs += bench::secondsSince(T0);
+    T0 = bench::Clock::now();
+    PolyHits += W.narrowphase();
+    PolySecs += bench::secondsSince(T0);
+    Pairs += W.pairs();
+
+    std::vector<std::unique_ptr<boxed::Shape>> Boxed;
+    BoxBounds.clear();
+    for (const auto& S : Scene)
+      S.visit([&] <typename T> (const T* P) {
+        if constexpr (!std::same_as<T, Shape>)
+          Boxed.push_back(std::make_unique<boxed::Impl<T>>(*P));
+      });
+    for (const auto& S : Boxed)
+      BoxBounds.push_back(S->bounds);
+    broadphase(BoxBounds, BoxPairs, Grid);
+    T0 = bench::Clock::now();
+    for (const Pair& P : BoxPairs)
+      BoxHits += Boxed[P.a]->collide(*Boxed[P.b]);
+    BoxSecs += bench::secondsSince(T0);
+  }
+
+  if (PolyHits != BoxHits) {
+    std::fprintf(stderr, "contact mismatch: %zu vs %zu\n", PolyHits, BoxHits);
+    return 1;
+  }
+  std::printf("shapes: %zu x %d scenes, %zu pairs, %zu contacts\n",
+    N, Scenes, Pairs, PolyHits);
+  std::printf("%-16s %7.2f M pairs/s\n", "broadphase", Pairs / BroadSecs / 1e6);
+  std::printf("%-16s %7.2f M pairs/s\n", "batched table",
+    Pairs / PolySecs / 1e6);
+  std::printf("%-16s %7.2f M pairs/s\n", "virtual dispatch",
+    Pairs / BoxSecs / 1e6);
+}
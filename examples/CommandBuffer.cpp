@@ -0,0 +1,194 @@
+//===- CommandBuffer.cpp --------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Records render/compute commands from several threads into
+//  efl::CommandBuffer, merges them at submit, sorts by key and executes.
+//  Compares against per-thread vectors of unique_ptr with virtual calls.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/CommandBuffer.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct Device {
+  std::uint64_t pipeline = 0, vertices = 0, groups = 0, bytes = 0;
+  float acc = 0;
+};
+
+//=== Commands ===//
+
+struct Cmd {};
+
+struct SetPipeline : Cmd {
+  std::uint32_t id;
+  void run(Device& D) const { D.pipeline = id; }
+};
+
+struct Draw : Cmd {
+  std::uint32_t first, count;
+  float transform[12];
+  void run(Device& D) const {
+    D.vertices += count;
+    D.acc += transform[0] + transform[5] + transform[10];
+  }
+};
+
+struct Dispatch : Cmd {
+  std::uint32_t x, y, z;
+  void run(Device& D) const { D.groups += std::uint64_t(x) * y * z; }
+};
+
+struct CopyBuffer : Cmd {
+  std::uint32_t src, dst, size;
+  void run(Device& D) const { D.bytes += size; }
+};
+
+using Buffer = efl::CommandBuffer<Cmd, SetPipeline, Draw, Dispatch, CopyBuffer>;
+
+/// [pipeline:16][depth:32][sequence:16]
+static std::uint64_t makeKey(std::uint32_t Pipe, std::uint32_t Depth,
+                             std::uint32_t Seq) {
+  return (std::uint64_t(Pipe & 0xFFFF) << 48)
+    | (std::uint64_t(Depth) << 16) | (Seq & 0xFFFF);
+}
+
+template <typename F>
+static void emit(bench::Rng& R, std::uint32_t K, F&& Fn) {
+  const std::uint32_t Pipe = R.below(32);
+  const std::uint64_t Key = makeKey(Pipe, R.below(1u << 20), K);
+  switch (R.below(8)) {
+   case 0: Fn(Key, SetPipeline{{}, Pipe}); break;
+   case 1: Fn(Key, Dispatch{{}, 8, 8, 1 + (K & 3)}); break;
+   case 2: Fn(Key, CopyBuffer{{}, K, K + 1, 256}); break;
+   default: {
+    Draw D {{}, K, 3 + (K & 63), {}};
+    for (int I = 0; I < 12; ++I)
+      D.transform[I] = float(I == 0 || I == 5 || I == 10);
+    Fn(Key, D);
+   }
+  }
+}
+
+//=== Boxed Baseline ===//
+
+namespace boxed {
+  struct Cmd {
+    std::uint64_t key;
+    virtual ~Cmd() = default;
+    virtual void run(Device& D) const = 0;
+  };
+
+  template <typename T>
+  struct Box final : Cmd {
+    T cmd;
+    void run(Device& D) const override { cmd.run(D); }
+  };
+} // namespace boxed
+
+int main(int Argc, char** Argv) {
+  const std::uint32_t N = Argc > 1
+    ? std::uint32_t(std::strtoul(Argv[1], nullptr, 10)) : 2'000'000;
+  const unsigned Threads = 4;
+  const int Frames = 5;
+
+  std::vector<Buffer> PerThread(Threads);
+  Buffer Frame;
+  Device PD;
+  double PRecord = 0, PSubmit = 0;
+  for (int F = 0; F < Frames; ++F) {
+    auto T0 = bench::Clock::now();
+    std::vector<std::thread> Pool;
+    for (unsigned T = 0; T < Threads; ++T)
+      Pool.emplace_back([&, T] {
+        bench::Rng R {0x1234 + T};
+        for (std::uint32_t K = T; K < N; K += Threads)
+          emit(R, K, [&] <typename C> (std::uint64_t Key, const C& Cm) {
+            PerThread[T].record<C>(Key, Cm);
+          });
+      });
+    for (auto& Th : Pool)
+      Th.join();
+    PRecord += bench::secondsSince(T0);
+
+    std::size_t Recorded = 0;
+    for (const Buffer& B : PerThread)
+      Recorded += B.bytes();
+    T0 = bench::Clock::now();
+    Frame.submit(PerThread);
+    if (Frame.bytes() != Recorded) {
+      std::fprintf(stderr, "submit: %zu bytes from %zu recorded\n",
+        Frame.bytes(), Recorded);
+      return 1;
+    }
+    Frame.sort();
+    Frame.execute([&PD] (const auto& C) { C.run(PD); });
+    Frame.clear();
+    PSubmit += bench::secondsSince(T0);
+  }
+
+  std::vector<std::vector<std::unique_ptr<boxed::Cmd>>> BoxThread(Threads);
+  Device BD;
+  double BRecord = 0, BSubmit = 0;
+  for (int F = 0; F < Frames; ++F) {
+    auto T0 = bench::Clock::now();
+    std::vector<std::thread> Pool;
+    for (unsigned T = 0; T < Threads; ++T)
+      Pool.emplace_back([&, T] {
+        bench::Rng R {0x1234 + T};
+        for (std::uint32_t K = T; K < N; K += Threads)
+          emit(R, K, [&] <typename C> (std::uint64_t Key, const C& Cm) {
+            auto B = std::make_unique<boxed::Box<C>>();
+            B->key = Key;
+            B->cmd = Cm;
+            BoxThread[T].push_back(std::move(B));
+          });
+      });
+    for (auto& Th : Pool)
+      Th.join();
+    BRecord += bench::secondsSince(T0);
+
+    T0 = bench::Clock::now();
+    std::vector<std::unique_ptr<boxed::Cmd>> All;
+    for (auto& V : BoxThread) {
+      for (auto& C : V)
+        All.push_back(std::move(C));
+      V.clear();
+    }
+    std::stable_sort(All.begin(), All.end(),
+      [] (const auto& A, const auto& B) { return A->key < B->key; });
+    for (auto& C : All)
+      C->run(BD);
+    BSubmit += bench::secondsSince(T0);
+  }
+
+  if (PD.vertices != BD.vertices || PD.groups != BD.groups
+      || PD.pipeline != BD.pipeline) {
+    std::fprintf(stderr, "execution mismatch\n");
+    return 1;
+  }
+  const double Cmds = double(N) * Frames;
+  std::printf("commands: %u x %d frames, %u recording threads\n",
+    N, Frames, Threads);
+  std::printf("%-14s record %7.1f M/s  submit+sort+execute %7.1f M/s\n",
+    "CommandBuffer", Cmds / PRecord / 1e6, Cmds / PSubmit / 1e6);
+  std::printf("%-14s record %7.1f M/s  submit+sort+execute %7.1f M/s\n",
+    "unique_ptr", Cmds / BRecord / 1e6, Cmds / BSubmit / 1e6);
+}
@@ -0,0 +1,479 @@
+//===- Dsp.cpp ------------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A block-based audio graph whose nodes are inline Poly values in
+//  topological order. Nodes process 128-sample blocks with SSE kernels
+//  where the recurrence allows it. Graph edits are built on a control
+//  thread and published through atomic pointers; the audio thread
+//  adopts them between blocks without locks or allocations. Reports
+//  how many nodes fit in a block deadline against virtual nodes.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+# include <xmmintrin.h>
+# define DSP_SSE 1
+#endif
+
+namespace dsp {
+  inline constexpr std::size_t Block = 128;
+  inline constexpr double SampleRate = 48'000.0;
+
+  struct alignas(16) Buffer {
+    float s[Block];
+  };
+
+  struct Context {
+    Buffer* buffers;
+    float* delayMemory;
+  };
+
+  /// Buffer 0 is silence; node `i` writes buffer `i + 1`.
+  struct Node {
+    std::uint16_t in0 = 0, in1 = 0, out = 0;
+    void process(const Context&) {}
+  };
+
+  /// Band-limited enough for a benchmark: a naive sawtooth.
+  struct Osc : Node {
+    float phase = 0, step = 0.01f;
+    void process(const Context& C) {
+      float* O = C.buffers[out].s;
+      float P = phase;
+      for (std::size_t I = 0; I < Block; ++I) {
+        P += step;
+        P -= float(P >= 1.0f);
+        O[I] = 2.0f * P - 1.0f;
+      }
+      phase = P;
+    }
+  };
+
+  struct Gain : Node {
+    float gain = 1;
+    void process(const Context& C) {
+      const float* X = C.buffers[in0].s;
+      float* O = C.buffers[out].s;
+#ifdef DSP_SSE
+      const __m128 G = _mm_set1_ps(gain);
+      for (std::size_t I = 0; I < Block; I += 4)
+        _mm_store_ps(O + I, _mm_mul_ps(_mm_load_ps(X + I), G));
+#else
+      for (std::size_t I = 0; I < Block; ++I)
+        O[I] = X[I] * gain;
+#endif
+    }
+  };
+
+  /// Transposed direct form II. The recurrence is serial in time, so
+  /// this one stays scalar.
+  struct Biquad : Node {
+    float b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+    float z1 = 0, z2 = 0;
+    void process(const Context& C) {
+      const float* X = C.buffers[in0].s;
+      float* O = C.buffers[out].s;
+      float S1 = z1, S2 = z2;
+      for (std::size_t I = 0; I < Block; ++I) {
+        const float Y = b0 * X[I] + S1;
+        S1 = b1 * X[I] - a1 * Y + S2;
+        S2 = b2 * X[I] - a2 * Y;
+        O[I] = Y;
+      }
+      z1 = S1;
+      z2 = S2;
+    }
+  };
+
+  struct Mixer : Node {
+    float g0 = 0.5f, g1 = 0.5f;
+    void process(const Context& C) {
+      const float* X = C.buffers[in0].s;
+      const float* Y = C.buffers[in1].s;
+      float* O = C.buffers[out].s;
+#ifdef DSP_SSE
+      const __m128 G0 = _mm_set1_ps(g0), G1 = _mm_set1_ps(g1);
+      for (std::size_t I = 0; I < Block; I += 4)
+        _mm_store_ps(O + I, _mm_add_ps(
+          _mm_mul_ps(_mm_load_ps(X + I), G0),
+          _mm_mul_ps(_mm_load_ps(Y + I), G1)));
+#else
+      for (std::size_t I = 0; I < Block; ++I)
+        O[I] = X[I] * g0 + Y[I] * g1;
+#endif
+    }
+  };
+
+  /// Feedback delay over a line in the graph's delay memory. Lines are
+  /// at least one block long, so each block touches at most two
+  /// contiguous runs that never alias the samples being written.
+  struct Delay : Node {
+    std::uint32_t offset = 0, length = Block, pos = 0;
+    float feedback = 0.5f;
+    void process(const Context& C) {
+      const float* X = C.buffers[in0].s;
+      float* O = C.buffers[out].s;
+      float* Line = C.delayMemory + offset;
+      std::size_t Done = 0;
+      while (Done < Block) {
+        const std::size_t Run = std::min<std::size_t>(
+          Block - Done, length - pos);
+        float* L = Line + pos;
+        std::size_t I = 0;
+#ifdef DSP_SSE
+        const __m128 F = _mm_set1_ps(feedback);
+        for (; I + 4 <= Run; I += 4) {
+          const __m128 Y = _mm_loadu_ps(L + I);
+          _mm_storeu_ps(O + Done + I, Y);
+          _mm_storeu_ps(L + I, _mm_add_ps(
+            _mm_loadu_ps(X + Done + I), _mm_mul_ps(Y, F)));
+        }
+#endif
+        for (; I < Run; ++I) {
+          const float Y = L[I];
+          O[Done + I] = Y;
+          L[I] = X[Done + I] + Y * feedback;
+        }
+        Done += Run;
+        pos = std::uint32_t((pos + Run) % length);
+      }
+    }
+  };
+
+  using NodePoly = efl::Poly<Node, Osc, Gain, Biquad, Mixer, Delay>;
+
+  inline void adopt(Node&, const Node&, const Context&, const Context&) {}
+  inline void adopt(Osc& N, const Osc& O, const Context&, const Context&) {
+    N.phase = O.phase;
+  }
+  inline void adopt(Biquad& N, const Biquad& O,
+                    const Context&, const Context&) {
+    N.z1 = O.z1;
+    N.z2 = O.z2;
+  }
+  inline void adopt(Delay& N, const Delay& O,
+                    const Context& NC, const Context& OC) {
+    if (N.length != O.length)
+      return;
+    if (NC.delayMemory != OC.delayMemory)
+      std::memcpy(NC.delayMemory + N.offset, OC.delayMemory + O.offset,
+        N.length * sizeof(float));
+    N.pos = O.pos;
+  }
+
+  /// A graph in topological order. Built on the control thread; only
+  /// `process` and `adoptState` run on the audio thread.
+  class Graph {
+  public:
+    /// Appends `N` with a stable `Key`. Inputs must be earlier nodes.
+    template <typename T>
+    std::uint16_t add(std::uint32_t Key, T N,
+                      std::uint16_t In0 = 0, std::uint16_t In1 = 0) {
+      N.in0 = In0;
+      N.in1 = In1;
+      N.out = std::uint16_t(nodes_.size() + 1);
+      if constexpr (std::same_as<T, Delay>) {
+        N.offset = std::uint32_t(delayMemory_.size());
+        N.length = std::max<std::uint32_t>(N.length, Block);
+        delayMemory_.resize(delayMemory_.size() + N.length);
+      }
+      nodes_.emplace_back(N);
+      keys_.push_back(Key);
+      buffers_.resize(nodes_.size() + 1);
+      return N.out;
+    }
+
+    void setOutput(std::uint16_t Buf) { output_ = Buf; }
+    std::uint16_t output() const { return output_; }
+    std::size_t size() const { return nodes_.size(); }
+    std::size_t delayMemorySize() const { return delayMemory_.size(); }
+
+    void process(float* Out) {
+      const Context C = this->context();
+      for (auto& N : nodes_)
+        N.visit([&C] <typename T> (T* P) { P->process(C); });
+      std::memcpy(Out, buffers_[output_].s, sizeof(Buffer));
+    }
+
+    /// Carries oscillator, filter and delay state over from `Old` for
+    /// nodes whose key and alternative are unchanged at the same index.
+    /// When every delay line keeps its place, the delay memory itself is
+    /// taken over, so the hand-over is O(nodes) rather than O(samples).
+    void adoptState(Graph& Old) {
+      const std::size_t N = std::min(nodes_.size(), Old.nodes_.size());
+      auto Matches = [&] (std::size_t I) {
+        return keys_[I] == Old.keys_[I]
+          && nodes_[I].typeId() == Old.nodes_[I].typeId();
+      };
+      bool SameLayout = delayMemory_.size() == Old.delayMemory_.size();
+      for (std::size_t I = 0; I < nodes_.size() && SameLayout; ++I) {
+        if (auto* D = nodes_[I].getIf<Delay>()) {
+          const Delay* O = I < N && Matches(I)
+            ? &Old.nodes_[I].getUnchecked<Delay>() : nullptr;
+          SameLayout = O && O->offset == D->offset && O->length == D->length;
+        }
+      }
+      if (SameLayout)
+        delayMemory_.swap(Old.delayMemory_);
+
+      const Context NC = this->context();
+      const Context OC = SameLayout ? NC : Old.context();
+      for (std::size_t I = 0; I < N; ++I) {
+        if (!Matches(I))
+          continue;
+        nodes_[I].visit([&] <typename T> (T* P) {
+          adopt(*P, Old.nodes_[I].getUnchecked<T>(), NC, OC);
+        });
+      }
+    }
+
+    NodePoly& operator[](std::size_t I) { return nodes_[I]; }
+
+  private:
+    Context context() {
+      return {buffers_.data(), delayMemory_.data()};
+    }
+
+    std::vector<NodePoly> nodes_;
+    std::vector<std::uint32_t> keys_;
+    std::vector<Buffer> buffers_ = std::vector<Buffer>(1);
+    std::vector<float> delayMemory_;
+    std::uint16_t output_ = 0;
+  };
+
+  /// Hands graphs from the control thread to the audio thread. The
+  /// audio thread takes a pending graph only once the control thread
+  /// has collected the previously retired one, so it never frees.
+  class Engine {
+  public:
+    ~Engine() {
+      delete pending_.load();
+      delete retired_.load();
+      delete current_;
+    }
+
+    /// Control thread. Replaces a pending graph that was never taken.
+    void publish(std::unique_ptr<Graph> G) {
+      delete pending_.exchange(G.release(), std::memory_order_acq_rel);
+      this->collect();
+    }
+
+    /// Control thread. Frees the graph the audio thread swapped out.
+    void collect() {
+      delete retired_.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    /// Audio thread.
+    void process(float* Out) {
+      if (!retired_.load(std::memory_order_acquire)) {
+        if (Graph* G = pending_.exchange(nullptr, std::memory_order_acq_rel)) {
+          if (current_)
+            G->adoptState(*current_);
+          retired_.store(current_, std::memory_order_release);
+          current_ = G;
+          ++swaps_;
+        }
+      }
+      if (current_)
+        current_->process(Out);
+      else
+        std::memset(Out, 0, sizeof(Buffer));
+    }
+
+    std::size_t swaps() const { return swaps_; }
+
+  private:
+    std::atomic<Graph*> pending_ {nullptr}, retired_ {nullptr};
+    Graph* current_ = nullptr;
+    std::size_t swaps_ = 0;
+  };
+} // namespace dsp
+
+//=== Virtual Baseline ===//
+
+namespace boxed {
+  struct Node {
+    virtual ~Node() = default;
+    virtual void process(const dsp::Context& C) = 0;
+  };
+
+  template <typename T>
+  struct Impl final : Node {
+    explicit Impl(const T& N) : node(N) {}
+    void process(const dsp::Context& C) override { node.process(C); }
+    T node;
+  };
+
+  /// The same patch as heap-allocated virtual nodes, interleaved with
+  /// unrelated allocations as in a long-running host.
+  struct Graph {
+    explicit Graph(dsp::Graph& G)
+     : buffers(G.size() + 1), delayMemory(G.delayMemorySize()),
+       output(G.output()) {
+      for (std::size_t I = 0; I < G.size(); ++I) {
+        G[I].visit([this] <typename T> (T* P) {
+          nodes.push_back(std::make_unique<Impl<T>>(*P));
+        });
+        scatter.push_back(std::make_unique<char[]>(64 + I % 256));
+      }
+    }
+
+    void process(float* Out) {
+      const dsp::Context C {buffers.data(), delayMemory.data()};
+      for (auto& N : nodes)
+        N->process(C);
+      std::memcpy(Out, buffers[output].s, sizeof(dsp::Buffer));
+    }
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::vector<std::unique_ptr<char[]>> scatter;
+    std::vector<dsp::Buffer> buffers;
+    std::vector<float> delayMemory;
+    std::uint16_t output;
+  };
+} // namespace boxed
+
+//=== Benchmark ===//
+
+/// A random patch of `N` nodes. `Gain` varies between edits so the
+/// control thread has something to change.
+static std::unique_ptr<dsp::Graph> makeGraph(std::size_t N, float Gain) {
+  using namespace dsp;
+  bench::Rng R;
+  auto G = std::make_unique<Graph>();
+  std::vector<std::uint16_t> Outs;
+  const std::size_t Sources = std::max<std::size_t>(1, N / 16);
+  for (std::uint32_t K = 0; K < N; ++K) {
+    auto Pick = [&] {
+      const std::size_t Back = std::min<std::size_t>(Outs.size(), 8);
+      return Outs[Outs.size() - 1 - R.below(std::uint32_t(Back))];
+    };
+    std::uint16_t Out;
+    if (K < Sources) {
+      Out = G->add(K, Osc{{}, 0, float(0.001 + R.unit() * 0.02)});
+    } else switch (R.below(4)) {
+     case 0:
+      Out = G->add(K, dsp::Gain{{}, Gain}, Pick());
+      break;
+     case 1: {
+      const float W = float(0.05 + R.unit() * 0.4), A = 0.9f;
+      Out = G->add(K, Biquad{{}, 1 - A, 0, 0, -2 * A * std::cos(W),
+        A * A}, Pick());
+      break;
+     }
+     case 2: {
+      const std::uint16_t In0 = Pick();
+      Out = G->add(K, Mixer{}, In0, Pick());
+      break;
+     }
+     default:
+      Out = G->add(K, Delay{{}, 0, 256 + R.below(4800), 0, 0.4f}, Pick());
+      break;
+    }
+    Outs.push_back(Out);
+  }
+  G->setOutput(Outs.back());
+  return G;
+}
+
+/// Returns the p99 block time in seconds.
+template <typename F>
+static double p99Block(std::size_t Blocks, F&& Process) {
+  std::vector<double> Times(Blocks);
+  for (std::size_t K = 0; K < 64; ++K)
+    Process();
+  for (auto& T : Times) {
+    const auto T0 = bench::Clock::now();
+    Process();
+    T = bench::secondsSince(T0);
+  }
+  std::sort(Times.begin(), Times.end());
+  return Times[Blocks * 99 / 100];
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t Blocks = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 2000;
+  const double Deadline = double(dsp::Block) / dsp::SampleRate;
+  alignas(16) float Out[dsp::Block], Ref[dsp::Block];
+
+  std::printf("deadline: %.0f us per %zu-sample block\n",
+    Deadline * 1e6, dsp::Block);
+  std::printf("%6s %12s %10s %12s %10s\n",
+    "nodes", "poly p99 us", "poly fit", "virt p99 us", "virt fit");
+  for (std::size_t N = 64; N <= 4096; N *= 4) {
+    auto G = makeGraph(N, 0.8f);
+    boxed::Graph B {*G};
+    G->process(Out);
+    B.process(Ref);
+    if (std::memcmp(Out, Ref, sizeof(Out)) != 0) {
+      std::fprintf(stderr, "output mismatch\n");
+      return 1;
+    }
+
+    const std::size_t Before = bench::allocs();
+    for (std::size_t K = 0; K < 64; ++K)
+      G->process(Out);
+    if (bench::allocs() != Before) {
+      std::fprintf(stderr, "allocation on the audio path\n");
+      return 1;
+    }
+    const double Poly = p99Block(Blocks, [&] { G->process(Out); });
+    const double Virt = p99Block(Blocks, [&] { B.process(Ref); });
+    std::printf("%6zu %12.1f %10.0f %12.1f %10.0f\n", N,
+      Poly * 1e6, N * Deadline / Poly, Virt * 1e6, N * Deadline / Virt);
+  }
+
+  // Live edits: the control thread republishes the patch with a new
+  // gain while the audio thread keeps processing.
+  const std::size_t N = 1024;
+  dsp::Engine E;
+  E.publish(makeGraph(N, 0.8f));
+  std::atomic<bool> Stop {false};
+  std::size_t Published = 0;
+  std::thread Control([&] {
+    for (float Gain = 0.5f; !Stop.load(std::memory_order_relaxed);) {
+      E.publish(makeGraph(N, Gain));
+      ++Published;
+      Gain = Gain > 0.9f ? 0.5f : Gain + 0.01f;
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    E.collect();
+  });
+  std::vector<double> Times(Blocks * 4);
+  for (auto& T : Times) {
+    const auto T0 = bench::Clock::now();
+    E.process(Out);
+    T = bench::secondsSince(T0);
+  }
+  Stop.store(true);
+  Control.join();
+  std::sort(Times.begin(), Times.end());
+  std::printf("edits: %zu published, %zu adopted, p99 block %.1f us, "
+    "worst %.1f us\n", Published, E.swaps(),
+    Times[Times.size() * 99 / 100] * 1e6, Times.back() * 1e6);
+}
@@ -0,0 +1,241 @@
+//===- HugePages.cpp ------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Fills and scans a large vector of Poly values through the default
+//  heap and through efl::HugePageAllocator with and without huge pages
+//  and pre-faulting. Reports fill time, sequential and random scan
+//  throughput, and dTLB load misses when perf counters are available.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/HugePages.hpp>
+#include <Poly/Poly.hpp>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if __has_include(<linux/perf_event.h>)
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+# define HUGEPAGES_PERF 1
+#endif
+
+struct Item {};
+
+struct Counter : Item {
+  std::uint64_t n;
+};
+
+struct Point : Item {
+  float x, y;
+};
+
+struct Range : Item {
+  std::uint32_t lo, hi;
+};
+
+using ItemPoly = efl::Poly<Item, Counter, Point, Range>;
+
+static std::uint64_t weigh(const ItemPoly& P) {
+  std::uint64_t W = 0;
+  P.visit([&W] <typename T> (const T* X) {
+    if constexpr (std::same_as<T, Counter>)
+      W = X->n;
+    else if constexpr (std::same_as<T, Point>)
+      W = std::uint64_t(X->x + X->y);
+    else if constexpr (std::same_as<T, Range>)
+      W = X->hi - X->lo;
+  });
+  return W;
+}
+
+/// Counts user-space dTLB load misses of this thread, if permitted.
+class TlbCounter {
+public:
+  TlbCounter() {
+#ifdef HUGEPAGES_PERF
+    perf_event_attr A;
+    std::memset(&A, 0, sizeof(A));
+    A.type = PERF_TYPE_HW_CACHE;
+    A.size = sizeof(A);
+    A.config = PERF_COUNT_HW_CACHE_DTLB
+      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    A.disabled = 1;
+    A.exclude_kernel = 1;
+    A.exclude_hv = 1;
+    fd_ = int(::syscall(SYS_perf_event_open, &A, 0, -1, -1, 0));
+#endif
+  }
+
+  TlbCounter(const TlbCounter&) = delete;
+
+  ~TlbCounter() {
+#ifdef HUGEPAGES_PERF
+    if (fd_ >= 0)
+      ::close(fd_);
+#endif
+  }
+
+  bool available() const { return fd_ >= 0; }
+
+  void start() {
+#ifdef HUGEPAGES_PERF
+    if (fd_ >= 0) {
+      ::ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ::ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  std::uint64_t stop() {
+    std::uint64_t N = 0;
+#ifdef HUGEPAGES_PERF
+    if (fd_ >= 0) {
+      ::ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (::read(fd_, &N, sizeof(N)) != sizeof(N))
+        N = 0;
+    }
+#endif
+    return N;
+  }
+
+private:
+  int fd_ = -1;
+};
+
+/// AnonHugePages of this process in KiB, or 0 if unknown.
+static std::size_t anonHugeKb() {
+  std::ifstream In("/proc/self/smaps_rollup");
+  std::string Line;
+  while (std::getline(In, Line))
+    if (Line.rfind("AnonHugePages:", 0) == 0)
+      return std::strtoull(Line.c_str() + 14, nullptr, 10);
+  return 0;
+}
+
+struct Result {
+  double mapSecs, fillSecs, seqSecs, randSecs;
+  std::uint64_t seqMisses, randMisses, sum;
+  std::size_t hugeKb;
+};
+
+template <typename Alloc>
+static Result run(const Alloc& A, std::size_t N, std::size_t Steps,
+                  TlbCounter& Tlb) {
+  Result R {};
+  const std::size_t HugeBefore = anonHugeKb();
+  const auto T0 = bench::Clock::now();
+  std::vector<ItemPoly, Alloc> Items(A);
+  Items.reserve(N);
+  R.mapSecs = bench::secondsSince(T0);
+
+  const auto T1 = bench::Clock::now();
+  for (std::size_t I = 0; I < N; ++I) {
+    const auto V = std::uint32_t(I);
+    switch (I % 3) {
+     case 0:  Items.emplace_back(Counter{{}, V}); break;
+     case 1:  Items.emplace_back(Point{{}, float(V & 255), 1.0f}); break;
+     default: Items.emplace_back(Range{{}, V, V + 7}); break;
+    }
+  }
+  R.fillSecs = bench::secondsSince(T1);
+  R.hugeKb = anonHugeKb() - std::min(HugeBefore, anonHugeKb());
+
+  std::uint64_t Sum = 0;
+  Tlb.start();
+  const auto T2 = bench::Clock::now();
+  for (const ItemPoly& P : Items)
+    Sum += weigh(P);
+  R.seqSecs = bench::secondsSince(T2);
+  R.seqMisses = Tlb.stop();
+
+  // Full-period LCG over the power-of-two size: every step lands on an
+  // unpredictable page.
+  std::size_t I = 0;
+  Tlb.start();
+  const auto T3 = bench::Clock::now();
+  for (std::size_t K = 0; K < Steps; ++K) {
+    I = (I * 6364136223846793005ull + 1442695040888963407ull) & (N - 1);
+    Sum += weigh(Items[I]);
+  }
+  R.randSecs = bench::secondsSince(T3);
+  R.randMisses = Tlb.stop();
+  R.sum = Sum;
+  return R;
+}
+
+//=== Benchmark ===//
+
+int main(int Argc, char** Argv) {
+  const std::size_t MiB = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 512;
+  const std::size_t N = std::bit_floor((MiB << 20) / sizeof(ItemPoly));
+  const std::size_t Steps = N / 4;
+  TlbCounter Tlb;
+
+  const efl::HugeRegion Probe(efl::HugePageSize);
+  static constexpr const char* Backings[] {"small", "transparent",
+    "explicit"};
+  std::printf("items: %zu x %zu bytes, probe mapping backed by %s pages\n",
+    N, sizeof(ItemPoly), Backings[int(Probe.backing())]);
+  if (!Tlb.available())
+    std::printf("dTLB counters unavailable; reporting throughput only\n");
+  std::printf("%-18s %8s %8s %9s %9s %12s %12s %8s\n", "config", "map ms",
+    "fill ms", "seq GB/s", "rand M/s", "seq dTLB", "rand dTLB", "THP MiB");
+
+  struct Config {
+    const char* name;
+    efl::HugePageOptions opts;
+  };
+  const Config Configs[] {
+    {"small pages",       {false, false, false}},
+    {"small + populate",  {false, false, true}},
+    {"huge pages",        {true, true, false}},
+    {"huge + populate",   {true, true, true}},
+  };
+
+  std::uint64_t Expect = 0;
+  auto Print = [&] (const char* Name, const Result& R) {
+    if (Expect != 0 && R.sum != Expect) {
+      std::fprintf(stderr, "%s: checksum mismatch\n", Name);
+      std::exit(1);
+    }
+    Expect = R.sum;
+    const double Bytes = double(N) * sizeof(ItemPoly);
+    std::printf("%-18s %8.1f %8.1f %9.2f %9.2f ", Name, R.mapSecs * 1e3,
+      R.fillSecs * 1e3, Bytes / R.seqSecs / 1e9,
+      double(Steps) / R.randSecs / 1e6);
+    if (Tlb.available())
+      std::printf("%12llu %12llu", (unsigned long long)R.seqMisses,
+        (unsigned long long)R.randMisses);
+    else
+      std::printf("%12s %12s", "-", "-");
+    std::printf(" %8zu\n", R.hugeKb >> 10);
+  };
+
+  Print("std::allocator", run(std::allocator<ItemPoly>(), N, Steps, Tlb));
+  for (const Config& C : Configs)
+    Print(C.name,
+      run(efl::HugePageAllocator<ItemPoly>(C.opts), N, Steps, Tlb));
+}
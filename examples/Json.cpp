@@ -0,0 +1,660 @@
+//===- Json.cpp -----------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  An arena-backed JSON DOM whose nodes are inline Poly values. Strings
+//  without escapes are views into the input, and bracket structure is
+//  validated up front with SSE2 when available. Compares parse and
+//  traversal throughput against a boxed unique_ptr DOM.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define JSON_SSE2 1
+#endif
+
+namespace json {
+  struct Value;
+  struct Member;
+
+  struct Node {};
+  struct Null   : Node {};
+  struct Bool   : Node { bool value = false; };
+  struct Number : Node { double value = 0.0; };
+  struct String : Node { std::string_view value; };
+  struct Array  : Node { const Value* items = nullptr; std::uint32_t size = 0; };
+  struct Object : Node { const Member* items = nullptr; std::uint32_t size = 0; };
+
+  struct Value : efl::Poly<Node, Null, Bool, Number, String, Array, Object> {
+    using Poly::Poly;
+    using Poly::operator=;
+  };
+
+  struct Member {
+    std::string_view key;
+    Value value;
+  };
+
+  /// Bump allocator; everything is released with the document.
+  class Arena {
+    static constexpr std::size_t ChunkSize = std::size_t(1) << 20;
+  public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    ~Arena() { this->reset(); }
+
+    void* allocate(std::size_t N, std::size_t Align) {
+      std::size_t Off = (used_ + Align - 1) & ~(Align - 1);
+      if (chunks_.empty() || Off + N > cap_) {
+        cap_ = std::max(ChunkSize, N + Align);
+        chunks_.push_back(static_cast<std::uint8_t*>(std::malloc(cap_)));
+        Off = 0;
+      }
+      used_ = Off + N;
+      return chunks_.back() + Off;
+    }
+
+    template <typename T>
+    T* copy(const T* Src, std::size_t N) {
+      if (N == 0)
+        return nullptr;
+      void* P = this->allocate(sizeof(T) * N, alignof(T));
+      T* Out = static_cast<T*>(P);
+      for (std::size_t I = 0; I < N; ++I)
+        (void) new (Out + I) T(Src[I]);
+      return Out;
+    }
+
+    void reset() {
+      for (auto* C : chunks_)
+        std::free(C);
+      chunks_.clear();
+      used_ = cap_ = 0;
+    }
+
+  private:
+    std::vector<std::uint8_t*> chunks_;
+    std::size_t used_ = 0, cap_ = 0;
+  };
+
+  //=== Structural Validation ===//
+
+  /// Checks that brackets outside of strings are balanced and properly
+  /// nested, and that strings contain no raw control characters. Blocks
+  /// without backslashes are classified 64 bytes at a time.
+  inline bool validateStructure(std::string_view In) {
+    char Stack[1024];
+    int Depth = 0;
+    bool InString = false, Escaped = false;
+
+    auto bracket = [&] (char C) {
+      if (C == '{' || C == '[') {
+        if (Depth == int(sizeof(Stack)))
+          return false;
+        Stack[Depth++] = C;
+        return true;
+      }
+      const char Open = (C == '}') ? '{' : '[';
+      return Depth != 0 && Stack[--Depth] == Open;
+    };
+
+    auto scalar = [&] (std::size_t Begin, std::size_t End) {
+      for (std::size_t I = Begin; I < End; ++I) {
+        const char C = In[I];
+        if (InString) {
+          if (Escaped)
+            Escaped = false;
+          else if (C == '\\')
+            Escaped = true;
+          else if (C == '"')
+            InString = false;
+          else if (static_cast<unsigned char>(C) < 0x20)
+            return false;
+        } else if (C == '"') {
+          InString = true;
+        } else if (C == '{' || C == '}' || C == '[' || C == ']') {
+          if (!bracket(C))
+            return false;
+        }
+      }
+      return true;
+    };
+
+    std::size_t I = 0;
+#ifdef JSON_SSE2
+    auto mask = [] (const char* P, char C) {
+      const __m128i Needle = _mm_set1_epi8(C);
+      std::uint64_t M = 0;
+      for (int K = 0; K < 4; ++K) {
+        const __m128i V = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(P + 16 * K));
+        M |= std::uint64_t(std::uint16_t(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(V, Needle)))) << (16 * K);
+      }
+      return M;
+    };
+    auto control = [] (const char* P) {
+      // Signed compare; bytes >= 0x80 are negative and excluded below.
+      const __m128i Limit = _mm_set1_epi8(0x20);
+      std::uint64_t M = 0;
+      for (int K = 0; K < 4; ++K) {
+        const __m128i V = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(P + 16 * K));
+        const __m128i Lt = _mm_andnot_si128(
+          _mm_cmplt_epi8(V, _mm_setzero_si128()), _mm_cmplt_epi8(V, Limit));
+        M |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(Lt))) << (16 * K);
+      }
+      return M;
+    };
+
+    for (; I + 64 <= In.size(); I += 64) {
+      const char* P = In.data() + I;
+      if (Escaped || mask(P, '\\') != 0) {
+        if (!scalar(I, I + 64))
+          return false;
+        continue;
+      }
+      const std::uint64_t Quotes = mask(P, '"');
+      // Prefix xor turns quote positions into an in-string mask.
+      std::uint64_t Str = Quotes;
+      for (int S = 1; S < 64; S <<= 1)
+        Str ^= Str << S;
+      if (InString)
+        Str = ~Str;
+      InString = (Str >> 63) != 0;
+      if (control(P) & Str & ~Quotes)
+        return false;
+      std::uint64_t Brackets = (mask(P, '{') | mask(P, '}')
+        | mask(P, '[') | mask(P, ']')) & ~Str;
+      while (Brackets) {
+        const int Bit = __builtin_ctzll(Brackets);
+        if (!bracket(P[Bit]))
+          return false;
+        Brackets &= Brackets - 1;
+      }
+    }
+#endif
+    return scalar(I, In.size()) && !InString && Depth == 0;
+  }
+
+  //=== Lexing ===//
+
+  inline bool isSpace(char C) {
+    return C == ' ' || C == '\n' || C == '\r' || C == '\t';
+  }
+
+  struct Cursor {
+    const char* p;
+    const char* end;
+
+    void skip() {
+      while (p != end && isSpace(*p))
+        ++p;
+    }
+
+    bool eat(char C) {
+      this->skip();
+      if (p == end || *p != C)
+        return false;
+      ++p;
+      return true;
+    }
+
+    bool literal(std::string_view L) {
+      if (std::size_t(end - p) < L.size()
+          || std::memcmp(p, L.data(), L.size()) != 0)
+        return false;
+      p += L.size();
+      return true;
+    }
+
+    bool number(double& Out) {
+      const auto R = std::from_chars(p, end, Out);
+      if (R.ec != std::errc{})
+        return false;
+      p = R.ptr;
+      return true;
+    }
+
+    /// Scans a string body after the opening quote. Returns the raw body
+    /// and whether it contains escapes.
+    bool string(std::string_view& Raw, bool& HasEscape) {
+      const char* Begin = p;
+      HasEscape = false;
+      for (;;) {
+#ifdef JSON_SSE2
+        while (end - p >= 16) {
+          const __m128i V = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p));
+          const int M = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(V, _mm_set1_epi8('"')),
+            _mm_cmpeq_epi8(V, _mm_set1_epi8('\\'))));
+          if (M != 0) {
+            p += __builtin_ctz(unsigned(M));
+            break;
+          }
+          p += 16;
+        }
+#endif
+        while (p != end && *p != '"' && *p != '\\')
+          ++p;
+        if (p == end)
+          return false;
+        if (*p == '"')
+          break;
+        HasEscape = true;
+        p += 2;
+        if (p > end)
+          return false;
+      }
+      Raw = std::string_view(Begin, std::size_t(p - Begin));
+      ++p;
+      return true;
+    }
+  };
+
+  /// Decodes escapes in `Raw` into `Out`. `\u` sequences are written as
+  /// UTF-8; surrogate pairs are combined.
+  inline std::size_t unescape(std::string_view Raw, char* Out) {
+    char* O = Out;
+    auto hex = [] (const char* H) {
+      unsigned V = 0;
+      for (int K = 0; K < 4; ++K) {
+        const char C = H[K];
+        V = V * 16 + unsigned(C <= '9' ? C - '0' : (C | 0x20) - 'a' + 10);
+      }
+      return V;
+    };
+    for (std::size_t I = 0; I < Raw.size(); ++I) {
+      if (Raw[I] != '\\') {
+        *O++ = Raw[I];
+        continue;
+      }
+      const char E = Raw[++I];
+      switch (E) {
+       case 'b': *O++ = '\b'; break;
+       case 'f': *O++ = '\f'; break;
+       case 'n': *O++ = '\n'; break;
+       case 'r': *O++ = '\r'; break;
+       case 't': *O++ = '\t'; break;
+       case 'u': {
+        if (I + 4 >= Raw.size())
+          return std::size_t(O - Out);
+        unsigned CP = hex(&Raw[I + 1]);
+        I += 4;
+        if (CP >= 0xD800 && CP < 0xDC00 && I + 6 < Raw.size()
+            && Raw[I + 1] == '\\' && Raw[I + 2] == 'u') {
+          CP = 0x10000 + ((CP - 0xD800) << 10)
+            + (hex(&Raw[I + 3]) - 0xDC00);
+          I += 6;
+        }
+        if (CP < 0x80) {
+          *O++ = char(CP);
+        } else if (CP < 0x800) {
+          *O++ = char(0xC0 | (CP >> 6));
+          *O++ = char(0x80 | (CP & 0x3F));
+        } else if (CP < 0x10000) {
+          *O++ = char(0xE0 | (CP >> 12));
+          *O++ = char(0x80 | ((CP >> 6) & 0x3F));
+          *O++ = char(0x80 | (CP & 0x3F));
+        } else {
+          *O++ = char(0xF0 | (CP >> 18));
+          *O++ = char(0x80 | ((CP >> 12) & 0x3F));
+          *O++ = char(0x80 | ((CP >> 6) & 0x3F));
+          *O++ = char(0x80 | (CP & 0x3F));
+        }
+        break;
+       }
+       default: *O++ = E; break;
+      }
+    }
+    return std::size_t(O - Out);
+  }
+
+  //=== Document ===//
+
+  class Document {
+  public:
+    /// Parses `In`, which must outlive the document.
+    bool parse(std::string_view In) {
+      arena_.reset();
+      values_.clear();
+      members_.clear();
+      if (!validateStructure(In))
+        return false;
+      Cursor C {In.data(), In.data() + In.size()};
+      if (!this->parseValue(C, root_))
+        return false;
+      C.skip();
+      return C.p == C.end;
+    }
+
+    const Value& root() const { return root_; }
+
+  private:
+    bool parseValue(Cursor& C, Value& Out) {
+      C.skip();
+      if (C.p == C.end)
+        return false;
+      switch (*C.p) {
+       case 'n':
+        Out = Null{};
+        return C.literal("null");
+       case 't':
+        Out = Bool{{}, true};
+        return C.literal("true");
+       case 'f':
+        Out = Bool{{}, false};
+        return C.literal("false");
+       case '"': {
+        ++C.p;
+        std::string_view S;
+        if (!this->parseString(C, S))
+          return false;
+        Out = String{{}, S};
+        return true;
+       }
+       case '[':
+        ++C.p;
+        return this->parseArray(C, Out);
+       case '{':
+        ++C.p;
+        return this->parseObject(C, Out);
+       default: {
+        Number N;
+        if (!C.number(N.value))
+          return false;
+        Out = N;
+        return true;
+       }
+      }
+    }
+
+    bool parseString(Cursor& C, std::string_view& Out) {
+      std::string_view Raw;
+      bool HasEscape;
+      if (!C.string(Raw, HasEscape))
+        return false;
+      if (HasEscape) {
+        auto* Buf = static_cast<char*>(arena_.allocate(Raw.size(), 1));
+        Raw = std::string_view(Buf, unescape(Raw, Buf));
+      }
+      Out = Raw;
+      return true;
+    }
+
+    // Children are gathered on a reusable stack, then copied
+    // contiguously into the arena once the container closes.
+    bool parseArray(Cursor& C, Value& Out) {
+      const std::size_t Mark = values_.size();
+      if (!C.eat(']')) {
+        do {
+          Value V;
+          if (!this->parseValue(C, V))
+            return false;
+          values_.push_back(std::move(V));
+        } while (C.eat(','));
+        if (!C.eat(']'))
+          return false;
+      }
+      const std::size_t N = values_.size() - Mark;
+      Out = Array{{}, arena_.copy(values_.data() + Mark, N),
+        std::uint32_t(N)};
+      values_.resize(Mark);
+      return true;
+    }
+
+    bool parseObject(Cursor& C, Value& Out) {
+      const std::size_t Mark = members_.size();
+      if (!C.eat('}')) {
+        do {
+          if (!C.eat('"'))
+            return false;
+          Member M;
+          if (!this->parseString(C, M.key) || !C.eat(':'))
+            return false;
+          if (!this->parseValue(C, M.value))
+            return false;
+          members_.push_back(std::move(M));
+        } while (C.eat(','));
+        if (!C.eat('}'))
+          return false;
+      }
+      const std::size_t N = members_.size() - Mark;
+      Out = Object{{}, arena_.copy(members_.data() + Mark, N),
+        std::uint32_t(N)};
+      members_.resize(Mark);
+      return true;
+    }
+
+  private:
+    Arena arena_;
+    Value root_;
+    std::vector<Value> values_;
+    std::vector<Member> members_;
+  };
+
+  struct Totals {
+    double numbers = 0;
+    std::size_t chars = 0, nodes = 0;
+  };
+
+  inline void walk(const Value& V, Totals& T) {
+    ++T.nodes;
+    V.visit([&T] <typename U> (const U* P) {
+      if constexpr (std::same_as<U, Number>) {
+        T.numbers += P->value;
+      } else if constexpr (std::same_as<U, String>) {
+        T.chars += P->value.size();
+      } else if constexpr (std::same_as<U, Array>) {
+        for (std::uint32_t I = 0; I < P->size; ++I)
+          walk(P->items[I], T);
+      } else if constexpr (std::same_as<U, Object>) {
+        for (std::uint32_t I = 0; I < P->size; ++I) {
+          T.chars += P->items[I].key.size();
+          walk(P->items[I].value, T);
+        }
+      }
+    });
+  }
+} // namespace json
+
+//=== Boxed Baseline ===//
+
+namespace boxed {
+  struct Node {
+    virtual ~Node() = default;
+  };
+  using Ptr = std::unique_ptr<Node>;
+
+  struct Null   : Node {};
+  struct Bool   : Node { bool value; explicit Bool(bool V) : value(V) {} };
+  struct Number : Node { double value; explicit Number(double V) : value(V) {} };
+  struct String : Node { std::string value; };
+  struct Array  : Node { std::vector<Ptr> items; };
+  struct Object : Node { std::vector<std::pair<std::string, Ptr>> items; };
+
+  inline bool parseString(json::Cursor& C, std::string& Out) {
+    std::string_view Raw;
+    bool HasEscape;
+    if (!C.string(Raw, HasEscape))
+      return false;
+    Out.resize(Raw.size());
+    Out.resize(HasEscape ? json::unescape(Raw, Out.data()) : Raw.size());
+    if (!HasEscape)
+      std::memcpy(Out.data(), Raw.data(), Raw.size());
+    return true;
+  }
+
+  inline Ptr parseValue(json::Cursor& C) {
+    C.skip();
+    if (C.p == C.end)
+      return nullptr;
+    switch (*C.p) {
+     case 'n': return C.literal("null") ? std::make_unique<Null>() : nullptr;
+     case 't': return C.literal("true") ? std::make_unique<Bool>(true) : nullptr;
+     case 'f': return C.literal("false") ? std::make_unique<Bool>(false) : nullptr;
+     case '"': {
+      ++C.p;
+      auto S = std::make_unique<String>();
+      return parseString(C, S->value) ? std::move(S) : nullptr;
+     }
+     case '[': {
+      ++C.p;
+      auto A = std::make_unique<Array>();
+      if (C.eat(']'))
+        return A;
+      do {
+        auto V = parseValue(C);
+        if (!V)
+          return nullptr;
+        A->items.push_back(std::move(V));
+      } while (C.eat(','));
+      return C.eat(']') ? std::move(A) : nullptr;
+     }
+     case '{': {
+      ++C.p;
+      auto O = std::make_unique<Object>();
+      if (C.eat('}'))
+        return O;
+      do {
+        std::string Key;
+        if (!C.eat('"') || !parseString(C, Key) || !C.eat(':'))
+          return nullptr;
+        auto V = parseValue(C);
+        if (!V)
+          return nullptr;
+        O->items.emplace_back(std::move(Key), std::move(V));
+      } while (C.eat(','));
+      return C.eat('}') ? std::move(O) : nullptr;
+     }
+     default: {
+      double D;
+      return C.number(D) ? std::make_unique<Number>(D) : nullptr;
+     }
+    }
+  }
+
+  inline void walk(const Node& N, json::Totals& T) {
+    ++T.nodes;
+    if (auto* P = dynamic_cast<const Number*>(&N)) {
+      T.numbers += P->value;
+    } else if (auto* P = dynamic_cast<const String*>(&N)) {
+      T.chars += P->value.size();
+    } else if (auto* P = dynamic_cast<const Array*>(&N)) {
+      for (auto& E : P->items)
+        walk(*E, T);
+    } else if (auto* P = dynamic_cast<const Object*>(&N)) {
+      for (auto& [K, V] : P->items) {
+        T.chars += K.size();
+        walk(*V, T);
+      }
+    }
+  }
+} // namespace boxed
+
+//=== Benchmark ===//
+
+static std::string makeDocument(std::size_t Records) {
+  bench::Rng R;
+  std::string S = "[";
+  char Buf[64];
+  for (std::size_t I = 0; I < Records; ++I) {
+    if (I)
+      S += ',';
+    S += "{\"id\":";
+    S += std::to_string(I);
+    S += ",\"name\":\"user_";
+    S += std::to_string(R.below(1'000'000));
+    S += "\",\"active\":";
+    S += (R.next() & 1) ? "true" : "false";
+    std::snprintf(Buf, sizeof(Buf), ",\"score\":%.4f", R.unit() * 100);
+    S += Buf;
+    S += ",\"tags\":[\"alpha\",\"beta\\n\",\"gamma\"],\"owner\":null,";
+    S += "\"geo\":{\"lat\":";
+    std::snprintf(Buf, sizeof(Buf), "%.5f,\"lon\":%.5f}}",
+      R.unit() * 180 - 90, R.unit() * 360 - 180);
+    S += Buf;
+  }
+  S += ']';
+  return S;
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t Records = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 200'000;
+  const int Reps = 5;
+  const std::string Doc = makeDocument(Records);
+  const double MB = double(Doc.size()) / (1 << 20);
+
+  json::Document D;
+  for (std::string_view Bad : {"[1,{]}", "{\"a\":[1,2}", "[\"x]", "[1,]"})
+    if (D.parse(Bad)) {
+      std::fprintf(stderr, "accepted malformed input\n");
+      return 1;
+    }
+
+  double PolyParse = 1e30, PolyWalk = 1e30;
+  json::Totals PT;
+  for (int K = 0; K < Reps; ++K) {
+    auto T0 = bench::Clock::now();
+    if (!D.parse(Doc)) {
+      std::fprintf(stderr, "parse failed\n");
+      return 1;
+    }
+    PolyParse = std::min(PolyParse, bench::secondsSince(T0));
+    PT = {};
+    T0 = bench::Clock::now();
+    json::walk(D.root(), PT);
+    PolyWalk = std::min(PolyWalk, bench::secondsSince(T0));
+  }
+
+  double BoxParse = 1e30, BoxWalk = 1e30;
+  json::Totals BT;
+  for (int K = 0; K < Reps; ++K) {
+    auto T0 = bench::Clock::now();
+    json::Cursor C {Doc.data(), Doc.data() + Doc.size()};
+    boxed::Ptr Root = boxed::parseValue(C);
+    BoxParse = std::min(BoxParse, bench::secondsSince(T0));
+    BT = {};
+    T0 = bench::Clock::now();
+    boxed::walk(*Root, BT);
+    BoxWalk = std::min(BoxWalk, bench::secondsSince(T0));
+  }
+
+  if (PT.nodes != BT.nodes || PT.chars != BT.chars) {
+    std::fprintf(stderr, "DOM mismatch\n");
+    return 1;
+  }
+  std::printf("document: %.1f MB, %zu nodes\n", MB, PT.nodes);
+  std::printf("%-8s parse %7.1f MB/s  traverse %7.1f Mnodes/s\n", "poly",
+    MB / PolyParse, double(PT.nodes) / PolyWalk / 1e6);
+  std::printf("%-8s parse %7.1f MB/s  traverse %7.1f Mnodes/s\n", "boxed",
+    MB / BoxParse, double(BT.nodes) / BoxWalk / 1e6);
+  bench::doNotOptimize(PT.numbers + BT.numbers);
+}
@@ -0,0 +1,419 @@
+//===- Lexer.cpp ----------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A tokenizer for a small DSL that emits inline Poly tokens into a
+//  vector. Identifiers and strings are views into the source, and
+//  whitespace and identifier runs are scanned with SSE2. A streaming
+//  mode tokenizes an mmap'ed file in line-aligned chunks. Compares
+//  against a boxed unique_ptr token stream.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define LEXER_SSE2 1
+#endif
+
+#if __has_include(<sys/mman.h>)
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# define LEXER_MMAP 1
+#endif
+
+namespace lex {
+  struct Token { std::uint32_t line = 0; };
+  struct Ident     : Token { std::string_view text; };
+  struct Number    : Token { std::int64_t value = 0; };
+  struct Punct     : Token { char op[2] {}; };
+  struct StringLit : Token { std::string_view text; };
+  struct Keyword   : Token { std::uint8_t kind = 0; };
+
+  using TokenPoly = efl::Poly<Token, Ident, Number, Punct, StringLit, Keyword>;
+  using TokenVector = std::vector<TokenPoly>;
+
+  inline constexpr std::string_view Keywords[] {
+    "fn", "let", "if", "else", "return", "while"
+  };
+
+  inline bool isIdentChar(char C) {
+    return (C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z')
+      || (C >= '0' && C <= '9') || C == '_';
+  }
+
+  inline bool isSpace(char C) {
+    return C == ' ' || C == '\t' || C == '\r' || C == '\n';
+  }
+
+#ifdef LEXER_SSE2
+  inline __m128i inRange(__m128i V, char Lo, char Hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(V, _mm_set1_epi8(char(Lo - 1))),
+      _mm_cmplt_epi8(V, _mm_set1_epi8(char(Hi + 1))));
+  }
+#endif
+
+  /// Returns the first position in [P, End) that is not whitespace.
+  /// Newlines are counted into `Line`.
+  inline const char* skipSpace(const char* P, const char* End,
+                               std::uint32_t& Line) {
+#ifdef LEXER_SSE2
+    while (End - P >= 16) {
+      const __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i*>(P));
+      const __m128i NL = _mm_cmpeq_epi8(V, _mm_set1_epi8('\n'));
+      const __m128i WS = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8(' ')), NL),
+        _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\t')),
+          _mm_cmpeq_epi8(V, _mm_set1_epi8('\r'))));
+      const unsigned Stop = ~unsigned(_mm_movemask_epi8(WS)) & 0xFFFF;
+      const unsigned Lines = unsigned(_mm_movemask_epi8(NL));
+      if (Stop != 0) {
+        const int N = __builtin_ctz(Stop);
+        Line += unsigned(__builtin_popcount(Lines & ((1u << N) - 1)));
+        return P + N;
+      }
+      Line += unsigned(__builtin_popcount(Lines));
+      P += 16;
+    }
+#endif
+    for (; P != End && isSpace(*P); ++P)
+      Line += (*P == '\n');
+    return P;
+  }
+
+  /// Returns the end of the identifier run starting at `P`.
+  inline const char* scanIdent(const char* P, const char* End) {
+#ifdef LEXER_SSE2
+    while (End - P >= 16) {
+      const __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i*>(P));
+      const __m128i Lower = _mm_or_si128(V, _mm_set1_epi8(0x20));
+      const __m128i Ok = _mm_or_si128(
+        _mm_or_si128(inRange(Lower, 'a', 'z'), inRange(V, '0', '9')),
+        _mm_cmpeq_epi8(V, _mm_set1_epi8('_')));
+      const unsigned Stop = ~unsigned(_mm_movemask_epi8(Ok)) & 0xFFFF;
+      if (Stop != 0)
+        return P + __builtin_ctz(Stop);
+      P += 16;
+    }
+#endif
+    while (P != End && isIdentChar(*P))
+      ++P;
+    return P;
+  }
+
+  /// Returns the closing quote of a string body starting at `P`.
+  inline const char* scanString(const char* P, const char* End) {
+    for (;;) {
+#ifdef LEXER_SSE2
+      while (End - P >= 16) {
+        const __m128i V = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(P));
+        const int M = _mm_movemask_epi8(_mm_or_si128(
+          _mm_cmpeq_epi8(V, _mm_set1_epi8('"')),
+          _mm_cmpeq_epi8(V, _mm_set1_epi8('\\'))));
+        if (M != 0) {
+          P += __builtin_ctz(unsigned(M));
+          break;
+        }
+        P += 16;
+      }
+#endif
+      while (P != End && *P != '"' && *P != '\\')
+        ++P;
+      if (P == End || *P == '"')
+        return P;
+      P = (End - P >= 2) ? P + 2 : End;
+    }
+  }
+
+  /// Tokenizes [Begin, End) into `Out`, returning false on bad input.
+  inline bool tokenize(const char* P, const char* End, TokenVector& Out,
+                       std::uint32_t& Line) {
+    for (;;) {
+      P = skipSpace(P, End, Line);
+      if (P == End)
+        return true;
+      const char C = *P;
+      if ((C | 0x20) >= 'a' && (C | 0x20) <= 'z') {
+        const char* E = scanIdent(P + 1, End);
+        const std::string_view Text(P, std::size_t(E - P));
+        std::uint8_t K = 0;
+        for (; K < std::size(Keywords); ++K)
+          if (Keywords[K] == Text)
+            break;
+        if (K != std::size(Keywords))
+          Out.emplace_back(Keyword{{Line}, K});
+        else
+          Out.emplace_back(Ident{{Line}, Text});
+        P = E;
+      } else if (C >= '0' && C <= '9') {
+        std::int64_t V = 0;
+        for (; P != End && *P >= '0' && *P <= '9'; ++P)
+          V = V * 10 + (*P - '0');
+        Out.emplace_back(Number{{Line}, V});
+      } else if (C == '"') {
+        const char* E = scanString(P + 1, End);
+        if (E == End)
+          return false;
+        Out.emplace_back(StringLit{{Line},
+          std::string_view(P + 1, std::size_t(E - P - 1))});
+        P = E + 1;
+      } else if (C == '/' && End - P >= 2 && P[1] == '/') {
+        const void* NL = std::memchr(P, '\n', std::size_t(End - P));
+        P = NL ? static_cast<const char*>(NL) : End;
+      } else {
+        Punct T {{Line}, {C, 0}};
+        if (End - P >= 2 && P[1] == '=' && std::strchr("=!<>+-", C))
+          T.op[1] = '=';
+        P += T.op[1] ? 2 : 1;
+        Out.emplace_back(T);
+      }
+    }
+  }
+
+#ifdef LEXER_MMAP
+  /// Maps `Path` and tokenizes it in chunks that end on a newline,
+  /// calling `Fn` with each chunk's tokens. Views stay valid until the
+  /// function returns.
+  template <typename F>
+  bool tokenizeFile(const char* Path, std::size_t Chunk, F&& Fn) {
+    const int Fd = ::open(Path, O_RDONLY);
+    if (Fd < 0)
+      return false;
+    struct stat St;
+    if (::fstat(Fd, &St) != 0 || St.st_size == 0) {
+      ::close(Fd);
+      return false;
+    }
+    const std::size_t Size = std::size_t(St.st_size);
+    void* Map = ::mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    ::close(Fd);
+    if (Map == MAP_FAILED)
+      return false;
+    ::madvise(Map, Size, MADV_SEQUENTIAL);
+
+    const char* Base = static_cast<const char*>(Map);
+    const char* P = Base;
+    const char* End = Base + Size;
+    TokenVector Tokens;
+    Tokens.reserve(Chunk / 4);
+    std::uint32_t Line = 1;
+    bool Ok = true;
+    while (Ok && P != End) {
+      const char* Stop = (std::size_t(End - P) > Chunk) ? P + Chunk : End;
+      if (Stop != End) {
+        const char* NL = static_cast<const char*>(
+          std::memchr(Stop, '\n', std::size_t(End - Stop)));
+        Stop = NL ? NL + 1 : End;
+        ::madvise(const_cast<char*>(Stop), std::min<std::size_t>(
+          Chunk, std::size_t(End - Stop)), MADV_WILLNEED);
+      }
+      Tokens.clear();
+      Ok = tokenize(P, Stop, Tokens, Line);
+      Fn(Tokens);
+      P = Stop;
+    }
+    ::munmap(Map, Size);
+    return Ok;
+  }
+#endif
+} // namespace lex
+
+//=== Boxed Baseline ===//
+
+namespace boxed {
+  struct Token {
+    virtual ~Token() = default;
+    std::uint32_t line = 0;
+  };
+  struct Ident     : Token { std::string text; };
+  struct Number    : Token { std::int64_t value = 0; };
+  struct Punct     : Token { char op[2] {}; };
+  struct StringLit : Token { std::string text; };
+  struct Keyword   : Token { std::uint8_t kind = 0; };
+
+  using TokenVector = std::vector<std::unique_ptr<Token>>;
+
+  template <typename T>
+  static T& make(TokenVector& Out, std::uint32_t Line) {
+    auto P = std::make_unique<T>();
+    P->line = Line;
+    T& R = *P;
+    Out.push_back(std::move(P));
+    return R;
+  }
+
+  /// The same grammar with scalar scanning and owned strings.
+  inline bool tokenize(const char* P, const char* End, TokenVector& Out) {
+    std::uint32_t Line = 1;
+    for (;;) {
+      for (; P != End && lex::isSpace(*P); ++P)
+        Line += (*P == '\n');
+      if (P == End)
+        return true;
+      const char C = *P;
+      if ((C | 0x20) >= 'a' && (C | 0x20) <= 'z') {
+        const char* E = P + 1;
+        while (E != End && lex::isIdentChar(*E))
+          ++E;
+        const std::string_view Text(P, std::size_t(E - P));
+        std::uint8_t K = 0;
+        for (; K < std::size(lex::Keywords); ++K)
+          if (lex::Keywords[K] == Text)
+            break;
+        if (K != std::size(lex::Keywords))
+          make<Keyword>(Out, Line).kind = K;
+        else
+          make<Ident>(Out, Line).text = Text;
+        P = E;
+      } else if (C >= '0' && C <= '9') {
+        std::int64_t V = 0;
+        for (; P != End && *P >= '0' && *P <= '9'; ++P)
+          V = V * 10 + (*P - '0');
+        make<Number>(Out, Line).value = V;
+      } else if (C == '"') {
+        const char* E = P + 1;
+        while (E != End && *E != '"')
+          E += (*E == '\\') ? 2 : 1;
+        if (E >= End)
+          return false;
+        make<StringLit>(Out, Line).text.assign(P + 1, E);
+        P = E + 1;
+      } else if (C == '/' && End - P >= 2 && P[1] == '/') {
+        while (P != End && *P != '\n')
+          ++P;
+      } else {
+        auto& T = make<Punct>(Out, Line);
+        T.op[0] = C;
+        if (End - P >= 2 && P[1] == '=' && std::strchr("=!<>+-", C))
+          T.op[1] = '=';
+        P += T.op[1] ? 2 : 1;
+      }
+    }
+  }
+} // namespace boxed
+
+//=== Benchmark ===//
+
+static std::string makeSource(std::size_t Bytes) {
+  bench::Rng R;
+  std::string S;
+  S.reserve(Bytes + 256);
+  const char* Names[] {"alpha", "beta_value", "gamma", "delta_count",
+    "x", "buffer_length", "iterator", "result"};
+  while (S.size() < Bytes) {
+    const char* A = Names[R.below(8)];
+    const char* B = Names[R.below(8)];
+    switch (R.below(5)) {
+     case 0:
+      S += "fn "; S += A; S += "("; S += B; S += ") {\n"; break;
+     case 1:
+      S += "    let "; S += A; S += " = "; S += B; S += " + ";
+      S += std::to_string(R.below(100000)); S += ";\n"; break;
+     case 2:
+      S += "    if "; S += A; S += " >= "; S += B;
+      S += " { return \"message for "; S += A; S += "\"; }\n"; break;
+     case 3:
+      S += "    // update "; S += B; S += " in place\n"; break;
+     default:
+      S += "    "; S += A; S += "("; S += B; S += ", ";
+      S += std::to_string(R.below(1000)); S += ");\n}\n"; break;
+    }
+  }
+  return S;
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t Bytes = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : (std::size_t(64) << 20);
+  const std::string Src = makeSource(Bytes);
+  const double MB = double(Src.size()) / (1 << 20);
+  const int Reps = 3;
+
+  double PolyBest = 1e30;
+  std::size_t PolyCount = 0;
+  lex::TokenVector Tokens;
+  for (int K = 0; K < Reps; ++K) {
+    Tokens.clear();
+    std::uint32_t Line = 1;
+    const auto T0 = bench::Clock::now();
+    if (!lex::tokenize(Src.data(), Src.data() + Src.size(), Tokens, Line))
+      return 1;
+    PolyBest = std::min(PolyBest, bench::secondsSince(T0));
+    PolyCount = Tokens.size();
+  }
+  lex::TokenVector().swap(Tokens);
+
+  double BoxBest = 1e30;
+  std::size_t BoxCount = 0;
+  for (int K = 0; K < Reps; ++K) {
+    boxed::TokenVector Boxed;
+    const auto T0 = bench::Clock::now();
+    if (!boxed::tokenize(Src.data(), Src.data() + Src.size(), Boxed))
+      return 1;
+    BoxBest = std::min(BoxBest, bench::secondsSince(T0));
+    BoxCount = Boxed.size();
+  }
+
+  if (PolyCount != BoxCount) {
+    std::fprintf(stderr, "token count mismatch\n");
+    return 1;
+  }
+  std::printf("source: %.1f MB, %zu tokens\n", MB, PolyCount);
+  std::printf("%-18s %8.1f MB/s\n", "poly (in memory)", MB / PolyBest);
+
+#ifdef LEXER_MMAP
+  char Path[] = "/tmp/poly-lexer-XXXXXX";
+  const int Fd = ::mkstemp(Path);
+  const char* Error = "cannot write the temporary source file";
+  if (Fd >= 0 && ::write(Fd, Src.data(), Src.size()) == ssize_t(Src.size())) {
+    std::size_t Streamed = 0;
+    const auto T0 = bench::Clock::now();
+    const bool Ok = lex::tokenizeFile(Path, std::size_t(1) << 20,
+      [&Streamed] (const lex::TokenVector& Chunk) {
+        Streamed += Chunk.size();
+      });
+    const double Secs = bench::secondsSince(T0);
+    if (!Ok)
+      Error = "mmap tokenization failed";
+    else if (Streamed != PolyCount)
+      Error = "mmap token count mismatch";
+    else
+      Error = nullptr;
+    if (!Error)
+      std::printf("%-18s %8.1f MB/s\n", "poly (mmap stream)", MB / Secs);
+  }
+  if (Fd >= 0) {
+    ::close(Fd);
+    ::unlink(Path);
+  }
+  if (Error) {
+    std::fprintf(stderr, "%s\n", Error);
+    return 1;
+  }
+#endif
+  std::printf("%-18s %8.1f MB/s\n", "boxed", MB / BoxBest);
+}
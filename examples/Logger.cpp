@@ -0,0 +1,430 @@
+//===- Logger.cpp ---------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A deferred-formatting logger. Call sites record a static format id
+//  and their arguments as Poly values into a per-thread SPSC byte ring;
+//  a background thread formats and writes them in batches. Compares
+//  hot-path cost against fprintf and std::format.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if __has_include(<format>)
+# include <format>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+# include <x86intrin.h>
+#endif
+
+namespace logging {
+  struct Arg {};
+  struct Int     : Arg { std::int64_t value; };
+  struct UInt    : Arg { std::uint64_t value; };
+  struct Double  : Arg { double value; };
+  struct Char    : Arg { char value; };
+  /// A string with static lifetime, stored by pointer.
+  struct StrView : Arg { const char* data; std::uint32_t size; };
+  /// A string copied into the ring right after the record.
+  struct Str     : Arg { std::uint32_t size; };
+
+  using ArgPoly = efl::Poly<Arg, Int, UInt, Double, Char, StrView, Str>;
+
+  /// Marks a string as outliving the logger, so it is not copied.
+  struct Literal { std::string_view str; };
+  inline Literal lit(std::string_view S) { return {S}; }
+
+  //=== Formats ===//
+
+  struct Site {
+    const char* file;
+    int line;
+    std::string_view format;
+  };
+
+  inline std::mutex SitesLock;
+  inline std::vector<Site> Sites;
+
+  inline std::uint32_t registerSite(const char* File, int Line,
+                                    std::string_view Format) {
+    std::lock_guard G {SitesLock};
+    Sites.push_back({File, Line, Format});
+    return std::uint32_t(Sites.size() - 1);
+  }
+
+  //=== Ring ===//
+
+  struct alignas(8) Header {
+    std::uint32_t site;
+    std::uint32_t extra;
+    std::uint64_t stamp;
+    std::uint16_t nargs;
+  };
+
+  inline constexpr std::uint32_t Wrap = ~std::uint32_t(0);
+
+  /// Single-producer single-consumer ring of variable-length records.
+  /// Records never straddle the end; a wrap marker sends the reader back
+  /// to the start.
+  class Ring {
+  public:
+    explicit Ring(std::size_t Bytes)
+     : buf_(static_cast<std::uint8_t*>(std::aligned_alloc(64, Bytes))),
+       cap_(Bytes) {}
+    Ring(const Ring&) = delete;
+    ~Ring() { std::free(buf_); }
+
+    /// Whether a record of `N` bytes can ever be reserved.
+    bool canHold(std::size_t N) const {
+      return N + sizeof(std::uint32_t) <= cap_;
+    }
+
+    /// Returns space for `N` bytes, or `nullptr` if the reader lags.
+    std::uint8_t* reserve(std::size_t N) {
+      std::size_t W = write_.load(std::memory_order_relaxed);
+      std::size_t Off = W % cap_;
+      if (Off + N + sizeof(std::uint32_t) > cap_) {
+        if (!this->fits(W, cap_ - Off))
+          return nullptr;
+        std::memcpy(buf_ + Off, &Wrap, sizeof(Wrap));
+        W += cap_ - Off;
+        Off = 0;
+        write_.store(W, std::memory_order_release);
+      }
+      return this->fits(W, N) ? buf_ + Off : nullptr;
+    }
+
+    void commit(std::size_t N) {
+      write_.store(write_.load(std::memory_order_relaxed) + N,
+        std::memory_order_release);
+    }
+
+    /// Returns readable bytes at the read cursor, skipping wrap markers.
+    std::size_t peek(std::uint8_t*& Out) {
+      std::size_t R = read_.load(std::memory_order_relaxed);
+      const std::size_t W = write_.load(std::memory_order_acquire);
+      if (R == W)
+        return 0;
+      std::uint32_t Tag;
+      std::memcpy(&Tag, buf_ + R % cap_, sizeof(Tag));
+      if (Tag == Wrap) {
+        R += cap_ - R % cap_;
+        read_.store(R, std::memory_order_release);
+        if (R == W)
+          return 0;
+      }
+      Out = buf_ + R % cap_;
+      return W - R;
+    }
+
+    void consume(std::size_t N) {
+      read_.store(read_.load(std::memory_order_relaxed) + N,
+        std::memory_order_release);
+    }
+
+  private:
+    bool fits(std::size_t W, std::size_t N) {
+      if (W + N - cachedRead_ <= cap_)
+        return true;
+      cachedRead_ = read_.load(std::memory_order_acquire);
+      return W + N - cachedRead_ <= cap_;
+    }
+
+    std::uint8_t* buf_;
+    std::size_t cap_;
+    alignas(64) std::atomic<std::size_t> write_ {0};
+    std::size_t cachedRead_ = 0;
+    alignas(64) std::atomic<std::size_t> read_ {0};
+  };
+
+  //=== Frontend ===//
+
+  inline std::uint64_t stamp() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return __rdtsc();
+#else
+    return std::uint64_t(bench::Clock::now().time_since_epoch().count());
+#endif
+  }
+
+  inline std::mutex RingsLock;
+  inline std::vector<Ring*> Rings;
+
+  inline Ring& threadRing() {
+    thread_local Ring* R = [] {
+      auto* New = new Ring(std::size_t(1) << 22);
+      std::lock_guard G {RingsLock};
+      Rings.push_back(New);
+      return New;
+    }();
+    return *R;
+  }
+
+  inline ArgPoly toArg(std::integral auto V) {
+    if constexpr (std::same_as<decltype(V), char>)
+      return Char{{}, V};
+    else if constexpr (std::is_signed_v<decltype(V)>)
+      return Int{{}, std::int64_t(V)};
+    else
+      return UInt{{}, std::uint64_t(V)};
+  }
+  inline ArgPoly toArg(std::floating_point auto V) {
+    return Double{{}, double(V)};
+  }
+  inline ArgPoly toArg(Literal L) {
+    return StrView{{}, L.str.data(), std::uint32_t(L.str.size())};
+  }
+  inline ArgPoly toArg(std::string_view S) {
+    return Str{{}, std::uint32_t(S.size())};
+  }
+
+  inline std::size_t extraBytes(const auto&) { return 0; }
+  inline std::size_t extraBytes(std::string_view S) { return S.size(); }
+
+  inline void writeExtra(std::uint8_t*&, const auto&) {}
+  inline void writeExtra(std::uint8_t*& P, std::string_view S) {
+    std::memcpy(P, S.data(), S.size());
+    P += S.size();
+  }
+
+  inline std::size_t recordSize(std::size_t NArgs, std::size_t Extra) {
+    const std::size_t N = sizeof(Header) + NArgs * sizeof(ArgPoly) + Extra;
+    return (N + 7) & ~std::size_t(7);
+  }
+
+  /// Anything string-like, other than a `Literal`, is copied.
+  template <typename T>
+  decltype(auto) normalize(const T& V) {
+    if constexpr (std::is_convertible_v<const T&, std::string_view>)
+      return std::string_view(V);
+    else
+      return (V);
+  }
+
+  template <typename...Args>
+  void recordNormalized(std::uint32_t Id, const Args&...args) {
+    const std::size_t Extra = (std::size_t(0) + ... + extraBytes(args));
+    const std::size_t N = recordSize(sizeof...(Args), Extra);
+    Ring& R = threadRing();
+    // Waiting for the reader would never free enough space.
+    if (!R.canHold(N)) [[unlikely]]
+      return;
+    std::uint8_t* P;
+    while (!(P = R.reserve(N)))
+      std::this_thread::yield();
+    const Header H {Id, std::uint32_t(Extra), stamp(),
+      std::uint16_t(sizeof...(Args))};
+    std::memcpy(P, &H, sizeof(H));
+    auto* A = reinterpret_cast<ArgPoly*>(P + sizeof(Header));
+    ((void) new (A++) ArgPoly(toArg(args)), ...);
+    auto* Tail = reinterpret_cast<std::uint8_t*>(A);
+    (writeExtra(Tail, args), ...);
+    R.commit(N);
+  }
+
+  template <typename...Args>
+  void record(std::uint32_t Id, const Args&...args) {
+    recordNormalized(Id, normalize(args)...);
+  }
+
+  //=== Backend ===//
+
+  /// Drains every ring, formatting `{}` placeholders in order.
+  class Backend {
+  public:
+    explicit Backend(std::FILE* Out) : out_(Out) {
+      buf_.reserve(BatchBytes * 2);
+      thread_ = std::thread([this] { this->run(); });
+    }
+
+    ~Backend() {
+      stop_.store(true, std::memory_order_release);
+      thread_.join();
+      this->drain();
+      this->flush();
+    }
+
+    std::uint64_t written() const { return written_; }
+
+  private:
+    static constexpr std::size_t BatchBytes = 1 << 16;
+
+    void run() {
+      while (!stop_.load(std::memory_order_acquire)) {
+        if (this->drain() == 0) {
+          this->flush();
+          std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+      }
+    }
+
+    std::size_t drain() {
+      {
+        std::lock_guard G {RingsLock};
+        rings_ = Rings;
+      }
+      std::size_t Count = 0;
+      for (Ring* R : rings_) {
+        std::uint8_t* P;
+        while (R->peek(P) != 0) {
+          Header H;
+          std::memcpy(&H, P, sizeof(H));
+          auto* Args = reinterpret_cast<ArgPoly*>(P + sizeof(Header));
+          const char* Extra = reinterpret_cast<const char*>(Args + H.nargs);
+          this->format(H, Args, Extra);
+          for (std::uint16_t K = 0; K < H.nargs; ++K)
+            Args[K].~ArgPoly();
+          R->consume(recordSize(H.nargs, H.extra));
+          ++Count;
+          if (buf_.size() >= BatchBytes)
+            this->flush();
+        }
+      }
+      return Count;
+    }
+
+    void format(const Header& H, const ArgPoly* Args, const char* Extra) {
+      if (H.site >= sites_.size()) {
+        std::lock_guard G {SitesLock};
+        sites_ = Sites;
+      }
+      const std::string_view Fmt = sites_[H.site].format;
+      this->number(H.stamp);
+      buf_ += ' ';
+      std::uint16_t K = 0;
+      for (std::size_t I = 0; I < Fmt.size(); ++I) {
+        if (Fmt[I] == '{' && I + 1 < Fmt.size() && Fmt[I + 1] == '}'
+            && K < H.nargs) {
+          Args[K++].visit([this, &Extra] <typename T> (const T* A) {
+            this->append(*A, Extra);
+          });
+          ++I;
+        } else {
+          buf_ += Fmt[I];
+        }
+      }
+      buf_ += '\n';
+      ++written_;
+    }
+
+    void number(auto V) {
+      char Tmp[32];
+      const auto R = std::to_chars(Tmp, Tmp + sizeof(Tmp), V);
+      buf_.append(Tmp, R.ptr);
+    }
+
+    void append(const Arg&, const char*&) {}
+    void append(const Int& A, const char*&) { this->number(A.value); }
+    void append(const UInt& A, const char*&) { this->number(A.value); }
+    void append(const Double& A, const char*&) { this->number(A.value); }
+    void append(const Char& A, const char*&) { buf_ += A.value; }
+    void append(const StrView& A, const char*&) {
+      buf_.append(A.data, A.size);
+    }
+    void append(const Str& A, const char*& Extra) {
+      buf_.append(Extra, A.size);
+      Extra += A.size;
+    }
+
+    void flush() {
+      if (buf_.empty())
+        return;
+      std::fwrite(buf_.data(), 1, buf_.size(), out_);
+      buf_.clear();
+    }
+
+    std::FILE* out_;
+    std::string buf_;
+    std::vector<Site> sites_;
+    std::vector<Ring*> rings_;
+    std::thread thread_;
+    std::atomic<bool> stop_ {false};
+    std::uint64_t written_ = 0;
+  };
+} // namespace logging
+
+/// Logs `Fmt` with `{}` placeholders. The format string must be a
+/// literal; it is registered once per call site.
+#define LOG(Fmt, ...) do { \
+  static const std::uint32_t PolyLogSite_ \
+    = ::logging::registerSite(__FILE__, __LINE__, Fmt); \
+  ::logging::record(PolyLogSite_ __VA_OPT__(,) __VA_ARGS__); \
+} while (0)
+
+//=== Benchmark ===//
+
+int main(int Argc, char** Argv) {
+  const std::size_t N = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 1'000'000;
+  std::vector<std::uint64_t> Ns(N);
+  std::string Name = "session-42";
+
+  auto timeLoop = [&] (const char* Label, auto&& Body) {
+    for (std::size_t K = 0; K < N; ++K) {
+      const auto T0 = bench::Clock::now();
+      Body(K);
+      const auto T1 = bench::Clock::now();
+      Ns[K] = std::uint64_t(std::chrono::duration_cast<
+        std::chrono::nanoseconds>(T1 - T0).count());
+    }
+    bench::printLatency(Label, Ns);
+  };
+
+  std::FILE* Out = std::tmpfile();
+  {
+    logging::Backend B {Out};
+    const auto T0 = bench::Clock::now();
+    timeLoop("poly logger", [&] (std::size_t K) {
+      LOG("order {} filled {} @ {} by {} on {}",
+        K, std::int32_t(K & 1023), 101.25 + double(K & 7),
+        std::string_view(Name), logging::lit("XNAS"));
+    });
+    std::printf("%-20s %.1f ns/call including drain\n", "",
+      bench::secondsSince(T0) * 1e9 / double(N));
+  }
+
+  timeLoop("fprintf", [&] (std::size_t K) {
+    std::fprintf(Out, "%llu order %zu filled %d @ %g by %s on %s\n",
+      (unsigned long long)logging::stamp(), K, int(K & 1023),
+      101.25 + double(K & 7), Name.c_str(), "XNAS");
+  });
+
+#if defined(__cpp_lib_format)
+  std::string Line;
+  timeLoop("std::format", [&] (std::size_t K) {
+    Line.clear();
+    std::format_to(std::back_inserter(Line),
+      "{} order {} filled {} @ {} by {} on {}\n", logging::stamp(), K,
+      K & 1023, 101.25 + double(K & 7), Name, "XNAS");
+    std::fwrite(Line.data(), 1, Line.size(), Out);
+  });
+#else
+  std::printf("std::format            unavailable in this standard library\n");
+#endif
+  std::fclose(Out);
+}
@@ -0,0 +1,272 @@
+//===- Metrics.cpp --------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A metrics registry whose cells are inline Poly values, sharded per
+//  thread. Updates touch only the calling thread's shard; scraping
+//  resolves each metric's type once and then sums every shard with
+//  unchecked access. Compares against virtual metrics behind a mutex.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace metrics {
+  // Most shards have a single writer, so cells use relaxed load/store
+  // pairs instead of read-modify-write; the atomics only make the
+  // concurrent scrape well-defined. The overflow shard is shared.
+  using Cell64 = std::atomic<std::uint64_t>;
+
+  inline void bump(Cell64& C, std::uint64_t N, bool Shared) {
+    if (Shared) [[unlikely]]
+      C.fetch_add(N, std::memory_order_relaxed);
+    else
+      C.store(C.load(std::memory_order_relaxed) + N,
+        std::memory_order_relaxed);
+  }
+
+  struct Metric {};
+
+  struct Counter : Metric {
+    Cell64 value {0};
+  };
+
+  struct Gauge : Metric {
+    Cell64 value {0}; // Two's complement; shards are summed.
+  };
+
+  struct Histogram : Metric {
+    static constexpr unsigned Buckets = 16;
+    std::array<Cell64, Buckets> buckets {};
+    Cell64 count {0}, sum {0};
+  };
+
+  using MetricCell = efl::Poly<Metric, Counter, Gauge, Histogram>;
+
+  /// Aggregated values produced by a scrape.
+  struct Sample {
+    std::string name;
+    std::size_t kind;
+    std::uint64_t value = 0, count = 0;
+    std::array<std::uint64_t, Histogram::Buckets> buckets {};
+  };
+
+  class Registry {
+  public:
+    static constexpr std::size_t MaxMetrics = 128;
+    static constexpr std::size_t MaxShards = 64;
+
+    struct alignas(64) Shard {
+      std::array<MetricCell, MaxMetrics> cells;
+      bool shared = false;
+    };
+
+    Registry() : shards_(std::make_unique<Shard[]>(MaxShards)) {
+      shards_[MaxShards - 1].shared = true;
+    }
+
+    /// Adds a metric and returns its id. At most `MaxMetrics` metrics
+    /// may be created; past that this throws.
+    template <typename T>
+    std::uint32_t create(std::string Name) {
+      std::lock_guard G {lock_};
+      if (names_.size() == MaxMetrics)
+        throw std::length_error("too many metrics");
+      const auto Id = std::uint32_t(names_.size());
+      names_.push_back(std::move(Name));
+      for (std::size_t S = 0; S < MaxShards; ++S)
+        (void) shards_[S].cells[Id].template emplace<T>();
+      return Id;
+    }
+
+    void inc(std::uint32_t Id, std::uint64_t N = 1) {
+      Shard& S = this->local();
+      bump(S.cells[Id].getUnchecked<Counter>().value, N, S.shared);
+    }
+
+    void add(std::uint32_t Id, std::int64_t N) {
+      Shard& S = this->local();
+      bump(S.cells[Id].getUnchecked<Gauge>().value, std::uint64_t(N),
+        S.shared);
+    }
+
+    void observe(std::uint32_t Id, std::uint64_t V) {
+      Shard& S = this->local();
+      auto& H = S.cells[Id].getUnchecked<Histogram>();
+      const unsigned B = std::min<unsigned>(
+        unsigned(std::bit_width(V)), Histogram::Buckets - 1);
+      bump(H.buckets[B], 1, S.shared);
+      bump(H.count, 1, S.shared);
+      bump(H.sum, V, S.shared);
+    }
+
+    /// Resolves each metric's alternative from the first shard, then
+    /// folds every live shard through the concrete type.
+    std::vector<Sample> scrape() {
+      std::lock_guard G {lock_};
+      const std::size_t Live = std::min(nextShard_.load(), MaxShards);
+      std::vector<Sample> Out(names_.size());
+      for (std::size_t Id = 0; Id < names_.size(); ++Id) {
+        Sample& S = Out[Id];
+        S.name = names_[Id];
+        S.kind = shards_[0].cells[Id].typeId();
+        shards_[0].cells[Id].visit([&] <typename T> (T*) {
+          for (std::size_t K = 0; K < Live; ++K)
+            fold(S, shards_[K].cells[Id].template getUnchecked<T>());
+        });
+      }
+      return Out;
+    }
+
+  private:
+    static std::uint64_t read(const Cell64& C) {
+      return C.load(std::memory_order_relaxed);
+    }
+
+    static void fold(Sample&, const Metric&) {}
+    static void fold(Sample& S, const Counter& C) { S.value += read(C.value); }
+    static void fold(Sample& S, const Gauge& C) { S.value += read(C.value); }
+    static void fold(Sample& S, const Histogram& H) {
+      for (unsigned B = 0; B < Histogram::Buckets; ++B)
+        S.buckets[B] += read(H.buckets[B]);
+      S.count += read(H.count);
+      S.value += read(H.sum);
+    }
+
+    /// Each thread caches its shard for the registry it used last,
+    /// keyed by generation. Threads past the limit share the last shard.
+    Shard& local() {
+      thread_local struct {
+        std::uint64_t generation = 0;
+        std::size_t index = 0;
+      } Cache;
+      if (Cache.generation != generation_) [[unlikely]]
+        Cache = {generation_, nextShard_.fetch_add(1)};
+      return shards_[std::min(Cache.index, MaxShards - 1)];
+    }
+
+    static inline std::atomic<std::uint64_t> NextGeneration {1};
+
+    std::unique_ptr<Shard[]> shards_;
+    std::vector<std::string> names_;
+    std::mutex lock_;
+    std::atomic<std::size_t> nextShard_ {0};
+    const std::uint64_t generation_ = NextGeneration.fetch_add(1);
+  };
+} // namespace metrics
+
+//=== Baseline ===//
+
+namespace locked {
+  struct Metric {
+    virtual ~Metric() = default;
+    virtual void update(std::uint64_t V) = 0;
+  };
+
+  struct Counter : Metric {
+    std::uint64_t value = 0;
+    void update(std::uint64_t V) override { value += V; }
+  };
+
+  struct Histogram : Metric {
+    std::uint64_t buckets[16] {}, count = 0, sum = 0;
+    void update(std::uint64_t V) override {
+      ++buckets[std::min<unsigned>(unsigned(std::bit_width(V)), 15)];
+      ++count;
+      sum += V;
+    }
+  };
+
+  struct Registry {
+    void update(std::size_t Id, std::uint64_t V) {
+      std::lock_guard G {lock};
+      metrics[Id]->update(V);
+    }
+    std::mutex lock;
+    std::vector<std::unique_ptr<Metric>> metrics;
+  };
+} // namespace locked
+
+//=== Benchmark ===//
+
+template <typename F>
+static double run(unsigned Threads, std::size_t PerThread, F&& Body) {
+  std::vector<std::thread> Pool;
+  std::atomic<bool> Go {false};
+  for (unsigned T = 0; T < Threads; ++T)
+    Pool.emplace_back([&, T] {
+      while (!Go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+      for (std::size_t K = 0; K < PerThread; ++K)
+        Body(T, K);
+    });
+  const auto T0 = bench::Clock::now();
+  Go.store(true, std::memory_order_release);
+  for (auto& Th : Pool)
+    Th.join();
+  return double(Threads) * double(PerThread) / bench::secondsSince(T0);
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t PerThread = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 500'000;
+
+  std::printf("%8s %16s %16s\n", "threads", "sharded Mops/s", "mutex Mops/s");
+  for (unsigned Threads = 1; Threads <= 64; Threads *= 2) {
+    metrics::Registry R;
+    const auto Requests = R.create<metrics::Counter>("requests");
+    const auto InFlight = R.create<metrics::Gauge>("in_flight");
+    const auto Latency = R.create<metrics::Histogram>("latency_us");
+    const double Sharded = run(Threads, PerThread,
+      [&] (unsigned, std::size_t K) {
+        R.inc(Requests);
+        R.add(InFlight, (K & 1) ? -1 : 1);
+        if ((K & 15) == 0)
+          R.observe(Latency, K & 4095);
+      });
+
+    locked::Registry L;
+    L.metrics.push_back(std::make_unique<locked::Counter>());
+    L.metrics.push_back(std::make_unique<locked::Counter>());
+    L.metrics.push_back(std::make_unique<locked::Histogram>());
+    const double Locked = run(Threads, PerThread,
+      [&] (unsigned, std::size_t K) {
+        L.update(0, 1);
+        L.update(1, 1);
+        if ((K & 15) == 0)
+          L.update(2, K & 4095);
+      });
+
+    const auto Samples = R.scrape();
+    if (Samples[0].value != Threads * PerThread) {
+      std::fprintf(stderr, "lost updates\n");
+      return 1;
+    }
+    std::printf("%8u %16.1f %16.1f\n", Threads,
+      Sharded * 2 / 1e6, Locked * 2 / 1e6);
+  }
+}
@@ -0,0 +1,389 @@
+//===- OrderBook.cpp ------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A price-time priority matching engine. Orders are carried inline as
+//  Poly values, resting orders live in pooled intrusive FIFOs, and
+//  fills dispatch on (incoming, resting) with a nested visit. Replays a
+//  synthetic feed and reports per-message latency.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+enum class Side : std::uint8_t { Buy, Sell };
+
+struct Order {
+  std::uint64_t id = 0;
+  std::uint32_t qty = 0;
+  std::int32_t price = 0;
+  Side side = Side::Buy;
+};
+
+struct Limit   : Order {};
+struct Market  : Order {};
+struct Stop    : Order { std::int32_t trigger = 0; };
+struct Iceberg : Order { std::uint32_t display = 0, hidden = 0; };
+struct Cancel  : Order {};
+struct Amend   : Order {};
+
+using Message = efl::Poly<Order, Limit, Market, Stop, Iceberg, Cancel, Amend>;
+using Resting = efl::Poly<Order, Limit, Iceberg>;
+
+/// Dispatches `Fn` on the active alternatives of every argument.
+template <typename F>
+void multiVisit(F&& Fn) { Fn(); }
+
+template <typename F, typename P, typename...PP>
+void multiVisit(F&& Fn, P& Head, PP&...Tail) {
+  Head.visit([&] <typename T> (T* Ptr) {
+    multiVisit([&] (auto*...Rest) { Fn(Ptr, Rest...); }, Tail...);
+  });
+}
+
+//=== Book ===//
+
+inline constexpr std::int32_t MaxTicks = 4096;
+inline constexpr std::uint32_t Nil = ~std::uint32_t(0);
+
+class Book {
+  struct Node {
+    Resting order;
+    std::uint32_t prev = Nil, next = Nil;
+  };
+
+  struct Level {
+    std::uint32_t head = Nil, tail = Nil;
+  };
+
+  struct StopNode {
+    Stop stop;
+    std::uint32_t next = Nil;
+  };
+
+public:
+  Book(std::uint32_t Capacity, std::uint64_t MaxIds)
+   : nodes_(Capacity), byId_(MaxIds, Nil),
+     bids_(MaxTicks), asks_(MaxTicks), stopNodes_(Capacity),
+     buyStops_(MaxTicks, Nil), sellStops_(MaxTicks, Nil) {
+    for (std::uint32_t I = 0; I < Capacity; ++I) {
+      nodes_[I].next = (I + 1 < Capacity) ? I + 1 : Nil;
+      stopNodes_[I].next = nodes_[I].next;
+    }
+    free_ = freeStop_ = Capacity ? 0 : Nil;
+  }
+
+  void onMessage(Message& M) {
+    M.visit([this, &M] <typename T> (T* P) { this->on(*P, M); });
+  }
+
+  std::uint64_t trades() const { return trades_; }
+  std::uint64_t volume() const { return volume_; }
+
+private:
+  void on(Order&, Message&) {}
+
+  void on(Stop& S, Message&) {
+    if (freeStop_ == Nil || S.trigger < 0 || S.trigger >= MaxTicks)
+      return;
+    const std::uint32_t I = freeStop_;
+    freeStop_ = stopNodes_[I].next;
+    stopNodes_[I].stop = S;
+    auto& Head = (S.side == Side::Buy ? buyStops_ : sellStops_)[S.trigger];
+    stopNodes_[I].next = Head;
+    Head = I;
+    if (S.side == Side::Buy)
+      lowBuyStop_ = std::min(lowBuyStop_, S.trigger);
+    else
+      highSellStop_ = std::max(highSellStop_, S.trigger);
+  }
+
+  template <typename T>
+  requires(std::same_as<T, Limit> || std::same_as<T, Market>
+    || std::same_as<T, Iceberg>)
+  void on(T& In, Message& M) {
+    this->match(In, M);
+    if (In.qty != 0) {
+      if constexpr (std::same_as<T, Limit>) {
+        this->rest(In);
+      } else if constexpr (std::same_as<T, Iceberg>) {
+        Iceberg R = In;
+        R.qty = std::min(In.qty, In.display);
+        R.hidden = In.qty - R.qty;
+        this->rest(R);
+      }
+    }
+    this->triggerStops();
+  }
+
+  void on(Cancel& C, Message&) {
+    if (C.id < byId_.size() && byId_[C.id] != Nil)
+      this->remove(byId_[C.id]);
+  }
+
+  void on(Amend& A, Message&) {
+    if (A.id >= byId_.size() || byId_[A.id] == Nil)
+      return;
+    const std::uint32_t I = byId_[A.id];
+    Order& Cur = *nodes_[I].order.operator->();
+    if (A.price == Cur.price && A.qty <= Cur.qty && A.qty != 0) {
+      Cur.qty = A.qty;
+      return;
+    }
+    // Anything else loses priority and is re-entered as a limit order.
+    const Side S = Cur.side;
+    this->remove(I);
+    if (A.qty == 0)
+      return;
+    Message Re = Limit{{A.id, A.qty, A.price, S}};
+    this->onMessage(Re);
+  }
+
+  //=== Matching ===//
+
+  template <typename T>
+  void match(T& In, Message& M) {
+    const bool Buy = (In.side == Side::Buy);
+    while (In.qty != 0) {
+      const std::int32_t Px = Buy ? bestAsk_ : bestBid_;
+      if (Px < 0 || Px >= MaxTicks)
+        break;
+      if (!std::same_as<T, Market> && (Buy ? Px > In.price : Px < In.price))
+        break;
+      const std::uint32_t I = (Buy ? asks_ : bids_)[Px].head;
+      multiVisit([this, Px, I] (auto* A, auto* R) {
+        this->fill(*A, *R, Px, I);
+      }, M, nodes_[I].order);
+    }
+  }
+
+  void fill(Order& A, Order& R, std::int32_t Px, std::uint32_t I) {
+    this->trade(A, R, Px);
+    if (R.qty == 0)
+      this->remove(I);
+  }
+
+  void fill(Order& A, Iceberg& R, std::int32_t Px, std::uint32_t I) {
+    this->trade(A, R, Px);
+    if (R.qty != 0)
+      return;
+    if (R.hidden == 0) {
+      this->remove(I);
+      return;
+    }
+    // Replenish the visible slice and send it to the back of the queue.
+    R.qty = std::min(R.display, R.hidden);
+    R.hidden -= R.qty;
+    Level& L = this->level(R.side, R.price);
+    this->unlink(L, I);
+    this->link(L, I);
+  }
+
+  void trade(Order& A, Order& R, std::int32_t Px) {
+    const std::uint32_t Q = std::min(A.qty, R.qty);
+    A.qty -= Q;
+    R.qty -= Q;
+    lastPx_ = Px;
+    ++trades_;
+    volume_ += Q;
+  }
+
+  /// Fires stops crossed by the last trade. Cascades are handled by
+  /// the outermost call, so the stack stays flat.
+  void triggerStops() {
+    if (inTrigger_ || lastPx_ < 0)
+      return;
+    inTrigger_ = true;
+    for (;;) {
+      std::uint32_t* Head = nullptr;
+      if (lowBuyStop_ <= lastPx_) {
+        Head = &buyStops_[lowBuyStop_];
+        if (*Head == Nil) {
+          ++lowBuyStop_;
+          continue;
+        }
+      } else if (highSellStop_ >= lastPx_) {
+        Head = &sellStops_[highSellStop_];
+        if (*Head == Nil) {
+          --highSellStop_;
+          continue;
+        }
+      } else {
+        break;
+      }
+      const std::uint32_t I = *Head;
+      const Stop S = stopNodes_[I].stop;
+      *Head = stopNodes_[I].next;
+      stopNodes_[I].next = freeStop_;
+      freeStop_ = I;
+      const std::int32_t Px = S.side == Side::Buy ? MaxTicks - 1 : 0;
+      Message M = Market{{S.id, S.qty, Px, S.side}};
+      this->onMessage(M);
+    }
+    inTrigger_ = false;
+  }
+
+  //=== Levels ===//
+
+  template <typename T>
+  void rest(const T& O) {
+    if (free_ == Nil || O.id >= byId_.size() || byId_[O.id] != Nil)
+      return;
+    const std::uint32_t I = free_;
+    free_ = nodes_[I].next;
+    nodes_[I].order = O;
+    byId_[O.id] = I;
+    this->link(this->level(O.side, O.price), I);
+    if (O.side == Side::Buy)
+      bestBid_ = std::max(bestBid_, O.price);
+    else
+      bestAsk_ = std::min(bestAsk_, O.price);
+  }
+
+  void remove(std::uint32_t I) {
+    const Order& O = *nodes_[I].order.operator->();
+    const Side S = O.side;
+    const std::int32_t Px = O.price;
+    Level& L = this->level(S, Px);
+    byId_[O.id] = Nil;
+    this->unlink(L, I);
+    nodes_[I].order.erase();
+    nodes_[I].next = free_;
+    free_ = I;
+    if (L.head != Nil)
+      return;
+    if (S == Side::Buy && Px == bestBid_) {
+      while (bestBid_ >= 0 && bids_[bestBid_].head == Nil)
+        --bestBid_;
+    } else if (S == Side::Sell && Px == bestAsk_) {
+      while (bestAsk_ < MaxTicks && asks_[bestAsk_].head == Nil)
+        ++bestAsk_;
+    }
+  }
+
+  Level& level(Side S, std::int32_t Px) {
+    return (S == Side::Buy ? bids_ : asks_)[Px];
+  }
+
+  void link(Level& L, std::uint32_t I) {
+    nodes_[I].prev = L.tail;
+    nodes_[I].next = Nil;
+    if (L.tail != Nil)
+      nodes_[L.tail].next = I;
+    else
+      L.head = I;
+    L.tail = I;
+  }
+
+  void unlink(Level& L, std::uint32_t I) {
+    Node& N = nodes_[I];
+    (N.prev != Nil ? nodes_[N.prev].next : L.head) = N.next;
+    (N.next != Nil ? nodes_[N.next].prev : L.tail) = N.prev;
+  }
+
+private:
+  std::vector<Node> nodes_;
+  std::vector<std::uint32_t> byId_;
+  std::vector<Level> bids_, asks_;
+  std::vector<StopNode> stopNodes_;
+  std::vector<std::uint32_t> buyStops_, sellStops_;
+  std::uint32_t free_ = Nil, freeStop_ = Nil;
+  std::int32_t lowBuyStop_ = MaxTicks;
+  std::int32_t highSellStop_ = -1;
+  bool inTrigger_ = false;
+  std::int32_t bestBid_ = -1;
+  std::int32_t bestAsk_ = MaxTicks;
+  std::int32_t lastPx_ = -1;
+  std::uint64_t trades_ = 0, volume_ = 0;
+};
+
+//=== Feed ===//
+
+/// Generates an ITCH-like mix of adds, cancels, amends and aggressors
+/// around a drifting mid price.
+static std::vector<Message> makeFeed(std::size_t N) {
+  bench::Rng R;
+  std::vector<Message> Feed;
+  Feed.reserve(N);
+  std::int32_t Mid = MaxTicks / 2;
+  std::uint64_t NextId = 1;
+  auto side = [&R] { return (R.next() & 1) ? Side::Buy : Side::Sell; };
+  auto pxFor = [&] (Side S) {
+    const std::int32_t Off = std::int32_t(R.below(16));
+    return S == Side::Buy ? Mid - 1 - Off : Mid + 1 + Off;
+  };
+  for (std::size_t K = 0; K < N; ++K) {
+    if ((K & 255) == 0)
+      Mid = std::clamp<std::int32_t>(
+        Mid + std::int32_t(R.below(5)) - 2, 64, MaxTicks - 64);
+    const std::uint32_t Roll = R.below(100);
+    const std::uint32_t Qty = 1 + R.below(500);
+    const std::uint64_t Old = 1 + R.below(std::uint32_t(NextId));
+    const Side S = side();
+    if (Roll < 50) {
+      Feed.emplace_back(Limit{{NextId++, Qty, pxFor(S), S}});
+    } else if (Roll < 75) {
+      Feed.emplace_back(Cancel{{Old, 0, 0, S}});
+    } else if (Roll < 83) {
+      Feed.emplace_back(Amend{{Old, Qty / 2, pxFor(S), S}});
+    } else if (Roll < 91) {
+      const std::int32_t Px = S == Side::Buy ? MaxTicks - 1 : 0;
+      Feed.emplace_back(Market{{NextId++, Qty, Px, S}});
+    } else if (Roll < 97) {
+      Iceberg I {{NextId++, Qty * 4, pxFor(S), S}, Qty / 4 + 1, 0};
+      Feed.emplace_back(I);
+    } else {
+      const std::int32_t Trig = S == Side::Buy ? Mid + 4 : Mid - 4;
+      Feed.emplace_back(Stop{{NextId++, Qty, 0, S}, Trig});
+    }
+  }
+  return Feed;
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t N = Argc > 1 ? std::strtoull(Argv[1], nullptr, 10)
+                                 : 2'000'000;
+  std::vector<Message> Feed = makeFeed(N);
+  std::vector<std::uint64_t> Ns(N);
+  Book B {1u << 20, N + 2};
+
+  const std::size_t Before = bench::allocs();
+  const auto Start = bench::Clock::now();
+  for (std::size_t K = 0; K < N; ++K) {
+    const auto T0 = bench::Clock::now();
+    B.onMessage(Feed[K]);
+    const auto T1 = bench::Clock::now();
+    Ns[K] = std::uint64_t(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(T1 - T0).count());
+  }
+  const double Secs = bench::secondsSince(Start);
+  const std::size_t Allocs = bench::allocs() - Before;
+
+  std::printf("messages: %zu  trades: %llu  volume: %llu\n", N,
+    (unsigned long long)B.trades(), (unsigned long long)B.volume());
+  std::printf("throughput: %.2f M msg/s  hot-path allocations: %zu\n",
+    double(N) / Secs / 1e6, Allocs);
+  bench::printLatency("per message", Ns);
+  if (Allocs != 0) {
+    std::fprintf(stderr, "hot path allocated %zu times\n", Allocs);
+    return 1;
+  }
+}
@@ -0,0 +1,182 @@
+//===- ParallelBulk.cpp ---------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Clone, fill and shutdown of large Poly arrays with the efl::par
+//  algorithms, compared to std::vector copying and destroying element
+//  by element. Runs a mixed set with owning alternatives and a fully
+//  trivial set, where copy is a memcpy and destruction is free.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Parallel.hpp>
+#include <Poly/Poly.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Entity {};
+
+struct Tag : Entity {
+  std::uint64_t bits;
+};
+
+struct Transform : Entity {
+  float m[12];
+};
+
+struct Name : Entity {
+  std::string text;
+};
+
+struct Path : Entity {
+  std::vector<float> points;
+};
+
+using Mixed = efl::Poly<Entity, Tag, Transform, Name, Path>;
+using Plain = efl::Poly<Entity, Tag, Transform>;
+
+/// Uninitialized storage for the efl::par algorithms. Elements must be
+/// destroyed with `par::destroy` before it is released.
+template <typename P>
+struct RawArray {
+  explicit RawArray(std::size_t N)
+   : data(std::allocator<P>().allocate(N)), size(N) {}
+  RawArray(const RawArray&) = delete;
+  ~RawArray() { std::allocator<P>().deallocate(data, size); }
+
+  std::span<P> span() const { return {data, size}; }
+
+  P* data;
+  std::size_t size;
+};
+
+template <typename P>
+static void populate(std::vector<P>& Out, std::size_t N) {
+  bench::Rng R;
+  Out.reserve(N);
+  for (std::size_t I = 0; I < N; ++I) {
+    const std::uint32_t K = R.below(10);
+    if (K < 4) {
+      Out.emplace_back(Tag{{}, I});
+    } else if (K < 7 || !std::same_as<P, Mixed>) {
+      Transform T {};
+      T.m[0] = float(I);
+      Out.emplace_back(T);
+    } else if constexpr (std::same_as<P, Mixed>) {
+      if (K < 9)
+        Out.emplace_back(Name{{}, "entity/" + std::to_string(I) + "/mesh"});
+      else
+        Out.emplace_back(Path{{}, std::vector<float>(8, float(I))});
+    }
+  }
+}
+
+static std::uint64_t fingerprint(const Tag& T) { return T.bits; }
+static std::uint64_t fingerprint(const Transform& T) {
+  return std::uint64_t(T.m[0]);
+}
+static std::uint64_t fingerprint(const Name& N) { return N.text.size(); }
+static std::uint64_t fingerprint(const Path& P) {
+  return std::uint64_t(P.points.back()) + P.points.size();
+}
+
+template <typename P>
+static std::uint64_t fingerprint(std::span<const P> S) {
+  std::uint64_t H = 0;
+  for (const P& X : S) {
+    H = H * 31 + X.typeId();
+    X.visit([&H] <typename T> (const T* V) {
+      if constexpr (!std::same_as<T, Entity>)
+        H += fingerprint(*V);
+    });
+  }
+  return H;
+}
+
+template <typename P>
+static bool run(const char* Set, efl::TaskPool& Pool, std::size_t N) {
+  std::vector<P> Src;
+  populate(Src, N);
+  const std::uint64_t Expect = fingerprint(std::span<const P>(Src));
+
+  // Both sides get fresh storage each round. The first round warms
+  // the heap; the second is reported.
+  double SeqClone = 0, ParClone = 0, SeqDrop = 0, ParDrop = 0;
+  double SeqFill = 0, ParFill = 0;
+  for (int Round = 0; Round < 2; ++Round) {
+    const auto T0 = bench::Clock::now();
+    std::vector<P> Copy(Src);
+    SeqClone = bench::secondsSince(T0);
+
+    RawArray<P> Par(N);
+    const auto T1 = bench::Clock::now();
+    efl::par::uninitializedCopy(Pool, Src, Par.data);
+    ParClone = bench::secondsSince(T1);
+
+    if (fingerprint(std::span<const P>(Par.span())) != Expect
+        || fingerprint(std::span<const P>(Copy)) != Expect) {
+      std::fprintf(stderr, "%s: clone mismatch\n", Set);
+      return false;
+    }
+
+    // Destruction only; both keep their storage for the fill.
+    const auto T2 = bench::Clock::now();
+    Copy.clear();
+    SeqDrop = bench::secondsSince(T2);
+
+    const auto T3 = bench::Clock::now();
+    efl::par::destroy(Pool, Par.span());
+    ParDrop = bench::secondsSince(T3);
+
+    // Fill with the cheapest alternative.
+    const auto T4 = bench::Clock::now();
+    for (std::size_t I = 0; I < N; ++I)
+      Copy.emplace_back(Tag{{}, 7});
+    bench::doNotOptimize(Copy.back());
+    SeqFill = bench::secondsSince(T4);
+
+    const auto T5 = bench::Clock::now();
+    efl::par::fillEmplace<Tag>(Pool, Par.data, N, Entity{},
+      std::uint64_t(7));
+    ParFill = bench::secondsSince(T5);
+    efl::par::destroy(Pool, Par.span());
+  }
+
+  std::printf("%-6s %-10s %9.1f ms  %-10s %9.1f ms\n", Set, "clone",
+    SeqClone * 1e3, "par clone", ParClone * 1e3);
+  std::printf("%-6s %-10s %9.1f ms  %-10s %9.1f ms\n", Set, "drop",
+    SeqDrop * 1e3, "par drop", ParDrop * 1e3);
+  std::printf("%-6s %-10s %9.1f ms  %-10s %9.1f ms\n", Set, "fill",
+    SeqFill * 1e3, "par fill", ParFill * 1e3);
+  return true;
+}
+
+//=== Benchmark ===//
+
+int main(int Argc, char** Argv) {
+  const std::size_t N = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 4'000'000;
+  const unsigned Threads = Argc > 2
+    ? unsigned(std::strtoul(Argv[2], nullptr, 10))
+    : std::thread::hardware_concurrency();
+  efl::TaskPool Pool(Threads);
+  std::printf("elements: %zu, pool: %u threads\n", N, Pool.size());
+  if (!run<Mixed>("mixed", Pool, N) || !run<Plain>("plain", Pool, N))
+    return 1;
+}
@@ -0,0 +1,434 @@
+//===- Replication.cpp ----------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Hot-standby replication of a Poly state store into a forked process.
+//  The primary tracks dirty slots and encodes them as (slot, id,
+//  payload) records straight into a shared-memory ring. The replica
+//  groups each frame by id and relocates payloads one alternative at a
+//  time. Reports replication lag and bandwidth under heavy writes.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <atomic>
+#include <cstring>
+#include <span>
+#include <thread>
+#include <vector>
+
+#if __has_include(<sys/mman.h>) && __has_include(<sys/wait.h>)
+# include <sys/mman.h>
+# include <sys/wait.h>
+# include <unistd.h>
+# define REPLICATION_FORK 1
+#endif
+
+namespace repl {
+  struct Row {};
+
+  struct Position : Row {
+    double x, y, z;
+  };
+
+  struct Counter : Row {
+    std::uint64_t value;
+  };
+
+  struct Flags : Row {
+    std::uint32_t bits;
+  };
+
+  struct Label : Row {
+    char text[24];
+  };
+
+  using RowPoly = efl::Poly<Row, Position, Counter, Flags, Label>;
+
+  /// Payloads are shipped as raw bytes.
+  static_assert(efl::H::all_trivially_relocatable<
+    Row, Position, Counter, Flags, Label>);
+
+  //=== Wire Format ===//
+
+  struct FrameHeader {
+    /// Total frame size including this header; 0 marks a wrap.
+    std::uint32_t bytes;
+    std::uint32_t records;
+    std::uint64_t seq;
+    /// Steady-clock time of the first mutation in the frame.
+    std::int64_t stampNs;
+  };
+
+  struct RecordHeader {
+    std::uint32_t slot;
+    std::uint16_t id;
+    std::uint16_t size;
+  };
+
+  inline constexpr std::uint64_t EndOfStream = ~std::uint64_t(0);
+  inline constexpr std::size_t MaxRecord =
+    sizeof(RecordHeader) + sizeof(RowPoly);
+
+  inline std::int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      bench::Clock::now().time_since_epoch()).count();
+  }
+
+  /// Single-producer, single-consumer ring of frames in memory shared
+  /// across fork. Frames are 8-byte aligned and never wrap; a zero-size
+  /// header sends the reader back to the start.
+  class FrameRing {
+    struct Control {
+      alignas(64) std::atomic<std::uint64_t> head {0};
+      alignas(64) std::atomic<std::uint64_t> tail {0};
+      alignas(64) std::atomic<std::uint64_t> replicaDigest {0};
+    };
+  public:
+    explicit FrameRing(std::size_t Capacity) : cap_(Capacity) {
+      void* P = ::mmap(nullptr, sizeof(Control) + cap_,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (P == MAP_FAILED)
+        throw std::bad_alloc();
+      ctl_ = new (P) Control();
+      data_ = static_cast<std::uint8_t*>(P) + sizeof(Control);
+    }
+
+    FrameRing(const FrameRing&) = delete;
+    ~FrameRing() { ::munmap(ctl_, sizeof(Control) + cap_); }
+
+    /// Producer: returns room for up to `N` bytes, waiting for space.
+    std::uint8_t* reserve(std::size_t N) {
+      N = align(N);
+      std::uint64_t T = ctl_->tail.load(std::memory_order_relaxed);
+      const std::size_t Pos = T % cap_;
+      if (cap_ - Pos < N) {
+        this->waitFor(T + (cap_ - Pos));
+        FrameHeader Wrap {};
+        std::memcpy(data_ + Pos, &Wrap, sizeof(Wrap.bytes));
+        T += cap_ - Pos;
+        ctl_->tail.store(T, std::memory_order_release);
+      }
+      this->waitFor(T + N);
+      return data_ + T % cap_;
+    }
+
+    /// Producer: publishes the frame written at the last reservation.
+    void commit(std::size_t N) {
+      ctl_->tail.fetch_add(align(N), std::memory_order_release);
+    }
+
+    /// Consumer: returns the next frame, waiting for one.
+    const std::uint8_t* next() {
+      for (;;) {
+        const std::uint64_t H = ctl_->head.load(std::memory_order_relaxed);
+        while (ctl_->tail.load(std::memory_order_acquire) == H)
+          std::this_thread::yield();
+        const std::size_t Pos = H % cap_;
+        std::uint32_t Bytes;
+        std::memcpy(&Bytes, data_ + Pos, sizeof(Bytes));
+        if (Bytes != 0)
+          return data_ + Pos;
+        ctl_->head.store(H + (cap_ - Pos), std::memory_order_release);
+      }
+    }
+
+    /// Consumer: frees the frame returned by `next`.
+    void release(std::size_t N) {
+      ctl_->head.fetch_add(align(N), std::memory_order_release);
+    }
+
+    std::atomic<std::uint64_t>& replicaDigest() { return ctl_->replicaDigest; }
+
+  private:
+    static std::size_t align(std::size_t N) { return (N + 7) & ~7ull; }
+
+    void waitFor(std::uint64_t End) {
+      while (End - ctl_->head.load(std::memory_order_acquire) > cap_)
+        std::this_thread::yield();
+    }
+
+    const std::size_t cap_;
+    Control* ctl_;
+    std::uint8_t* data_;
+  };
+
+  /// Order-sensitive digest of slot contents, for checking replicas.
+  inline std::uint64_t digest(std::span<const RowPoly> Slots) {
+    std::uint64_t H = 0xCBF29CE484222325ull;
+    for (const RowPoly& P : Slots) {
+      H = (H ^ P.typeId()) * 0x100000001B3ull;
+      P.visit([&H] <typename T> (const T* V) {
+        const auto* B = reinterpret_cast<const std::uint8_t*>(V);
+        for (std::size_t I = 0; I < sizeof(T); ++I)
+          H = (H ^ B[I]) * 0x100000001B3ull;
+      });
+    }
+    return H;
+  }
+
+  //=== Primary ===//
+
+  /// Slots plus a dirty bitmap and list. Repeated writes to a slot
+  /// between encodes ship once.
+  class TrackedStore {
+  public:
+    explicit TrackedStore(std::size_t N)
+     : slots_(N), dirtyBits_((N + 63) / 64) {}
+
+    template <typename T>
+    void set(std::uint32_t Slot, const T& V) {
+      slots_[Slot] = V;
+      this->touch(Slot);
+    }
+
+    void erase(std::uint32_t Slot) {
+      slots_[Slot].erase();
+      this->touch(Slot);
+    }
+
+    std::span<const RowPoly> slots() const { return slots_; }
+    std::size_t pending() const { return dirty_.size(); }
+    std::size_t maxEncodedSize() const {
+      return sizeof(FrameHeader) + dirty_.size() * MaxRecord;
+    }
+
+    /// Writes a frame of every slot changed since the last call and
+    /// returns its size.
+    std::size_t encode(std::uint8_t* Out, std::uint64_t Seq,
+                       std::int64_t StampNs) {
+      std::uint8_t* P = Out + sizeof(FrameHeader);
+      for (std::uint32_t Slot : dirty_) {
+        dirtyBits_[Slot / 64] = 0;
+        const RowPoly& V = slots_[Slot];
+        RecordHeader R {Slot, std::uint16_t(V.typeId()), 0};
+        std::uint8_t* Payload = P + sizeof(R);
+        V.visit([&] <typename T> (const T* X) {
+          std::memcpy(Payload, X, sizeof(T));
+          R.size = sizeof(T);
+        });
+        std::memcpy(P, &R, sizeof(R));
+        P = Payload + R.size;
+      }
+      const FrameHeader F {std::uint32_t(P - Out),
+        std::uint32_t(dirty_.size()), Seq, StampNs};
+      std::memcpy(Out, &F, sizeof(F));
+      dirty_.clear();
+      return F.bytes;
+    }
+
+  private:
+    void touch(std::uint32_t Slot) {
+      std::uint64_t& W = dirtyBits_[Slot / 64];
+      const std::uint64_t Bit = std::uint64_t(1) << (Slot % 64);
+      if (!(W & Bit)) {
+        W |= Bit;
+        dirty_.push_back(Slot);
+      }
+    }
+
+    std::vector<RowPoly> slots_;
+    std::vector<std::uint64_t> dirtyBits_;
+    std::vector<std::uint32_t> dirty_;
+  };
+
+  //=== Replica ===//
+
+  /// Applies frames. Records are counting-sorted by id so each
+  /// alternative's payloads are relocated in one dispatch-free loop.
+  class Replica {
+  public:
+    explicit Replica(std::size_t N) : slots_(N) {}
+
+    void apply(const std::uint8_t* Frame) {
+      FrameHeader F;
+      std::memcpy(&F, Frame, sizeof(F));
+      offsets_.resize(F.records);
+      constexpr std::size_t Ids = RowPoly::Size() + 1;
+      std::uint32_t Begin[Ids + 1] {};
+
+      const std::uint8_t* P = Frame + sizeof(F);
+      for (std::uint32_t K = 0; K < F.records; ++K) {
+        RecordHeader R;
+        std::memcpy(&R, P, sizeof(R));
+        ++Begin[R.id + 1];
+        P += sizeof(R) + R.size;
+      }
+      for (std::size_t I = 1; I <= Ids; ++I)
+        Begin[I] += Begin[I - 1];
+      std::uint32_t Fill[Ids];
+      std::copy(Begin, Begin + Ids, Fill);
+      P = Frame + sizeof(F);
+      for (std::uint32_t K = 0; K < F.records; ++K) {
+        RecordHeader R;
+        std::memcpy(&R, P, sizeof(R));
+        offsets_[Fill[R.id]++] = std::uint32_t(P - Frame);
+        P += sizeof(R) + R.size;
+      }
+
+      for (std::uint32_t I = Begin[0]; I < Begin[1]; ++I)
+        slots_[slotAt(Frame + offsets_[I])].erase();
+      this->relocate<Row, Position, Counter, Flags, Label>(Frame, Begin);
+    }
+
+    std::span<const RowPoly> slots() const { return slots_; }
+
+  private:
+    static std::uint32_t slotAt(const std::uint8_t* Record) {
+      std::uint32_t Slot;
+      std::memcpy(&Slot, Record, sizeof(Slot));
+      return Slot;
+    }
+
+    template <typename...Ts>
+    void relocate(const std::uint8_t* Frame, const std::uint32_t* Begin) {
+      ([&] {
+        constexpr std::size_t Id = RowPoly::IdOf<Ts>();
+        for (std::uint32_t I = Begin[Id]; I < Begin[Id + 1]; ++I) {
+          const std::uint8_t* R = Frame + offsets_[I];
+          Ts& Dst = slots_[slotAt(R)].template emplace<Ts>();
+          std::memcpy(&Dst, R + sizeof(RecordHeader), sizeof(Ts));
+        }
+      }(), ...);
+    }
+
+    std::vector<RowPoly> slots_;
+    std::vector<std::uint32_t> offsets_;
+  };
+} // namespace repl
+
+//=== Benchmark ===//
+
+static void mutate(repl::TrackedStore& S, bench::Rng& R, std::size_t N) {
+  const auto Slots = std::uint32_t(S.slots().size());
+  for (std::size_t K = 0; K < N; ++K) {
+    const std::uint32_t Slot = R.below(Slots);
+    switch (R.below(8)) {
+     case 0:
+      S.erase(Slot);
+      break;
+     case 1:
+     case 2:
+      S.set(Slot, repl::Position{{}, double(K), 1.0, 2.0});
+      break;
+     case 3:
+      S.set(Slot, repl::Flags{{}, std::uint32_t(K)});
+      break;
+     case 4: {
+      repl::Label L {};
+      std::snprintf(L.text, sizeof(L.text), "row-%u", unsigned(K));
+      S.set(Slot, L);
+      break;
+     }
+     default:
+      S.set(Slot, repl::Counter{{}, K});
+      break;
+    }
+  }
+}
+
+int main(int Argc, char** Argv) {
+#ifndef REPLICATION_FORK
+  (void) Argc;
+  (void) Argv;
+  std::printf("replication needs mmap and fork; skipped\n");
+#else
+  const std::size_t PerTick = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 2'000;
+  const std::size_t Slots = 1 << 20, Ticks = 2000;
+  const auto Period = std::chrono::microseconds(1000);
+  repl::FrameRing Ring(std::size_t(64) << 20);
+  std::printf("slots: %zu, %zu writes per %lld us tick, %zu ticks\n",
+    Slots, PerTick, (long long)Period.count(), Ticks);
+  // The replica reports once the stream ends; flush so the report is
+  // in order and the child does not inherit buffered output.
+  std::fflush(stdout);
+
+  const pid_t Child = ::fork();
+  if (Child < 0) {
+    std::perror("fork");
+    return 1;
+  }
+  if (Child == 0) {
+    repl::Replica Replica(Slots);
+    std::vector<std::uint64_t> Lag;
+    Lag.reserve(Ticks);
+    std::uint64_t Applied = 0;
+    double ApplySecs = 0;
+    for (;;) {
+      const std::uint8_t* Frame = Ring.next();
+      repl::FrameHeader F;
+      std::memcpy(&F, Frame, sizeof(F));
+      if (F.seq == repl::EndOfStream) {
+        Ring.release(F.bytes);
+        break;
+      }
+      const auto T0 = bench::Clock::now();
+      Replica.apply(Frame);
+      ApplySecs += bench::secondsSince(T0);
+      Applied += F.records;
+      Lag.push_back(std::uint64_t(repl::nowNs() - F.stampNs));
+      Ring.release(F.bytes);
+    }
+    bench::printLatency("replication lag", Lag);
+    std::printf("%-16s %8.2f M records/s applied\n", "replica",
+      double(Applied) / ApplySecs / 1e6);
+    std::fflush(stdout);
+    Ring.replicaDigest().store(repl::digest(Replica.slots()));
+    std::_Exit(0);
+  }
+
+  repl::TrackedStore Store(Slots);
+  bench::Rng R;
+  std::uint64_t Bytes = 0, Records = 0;
+  const auto T0 = bench::Clock::now();
+  auto Deadline = T0;
+  for (std::uint64_t Seq = 0; Seq < Ticks; ++Seq) {
+    Deadline += Period;
+    const std::int64_t Stamp = repl::nowNs();
+    mutate(Store, R, PerTick);
+    Records += Store.pending();
+    std::uint8_t* Out = Ring.reserve(Store.maxEncodedSize());
+    const std::size_t N = Store.encode(Out, Seq, Stamp);
+    Ring.commit(N);
+    Bytes += N;
+    std::this_thread::sleep_until(Deadline);
+  }
+  const double Secs = bench::secondsSince(T0);
+  const double Mutations = double(PerTick) * Ticks;
+  std::printf("%-16s %8.2f M writes/s, %.2f M records shipped\n",
+    "primary", Mutations / Secs / 1e6, double(Records) / 1e6);
+  std::printf("%-16s %8.2f MB/s, %.1f bytes/record "
+    "(fixed slots: %zu)\n", "stream", double(Bytes) / Secs / 1e6,
+    double(Bytes) / double(Records), repl::MaxRecord);
+  std::fflush(stdout);
+
+  const repl::FrameHeader End {sizeof(repl::FrameHeader), 0,
+    repl::EndOfStream, 0};
+  std::memcpy(Ring.reserve(sizeof(End)), &End, sizeof(End));
+  Ring.commit(sizeof(End));
+
+  int Status = 0;
+  ::waitpid(Child, &Status, 0);
+  if (!WIFEXITED(Status) || WEXITSTATUS(Status) != 0
+      || Ring.replicaDigest().load() != repl::digest(Store.slots())) {
+    std::fprintf(stderr, "replica diverged\n");
+    return 1;
+  }
+#endif
+}
@@ -0,0 +1,578 @@
+//===- Rules.cpp ----------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A small Rete-style rule engine over Poly facts. The alpha network is
+//  indexed by alternative id; each type keeps one flat predicate array
+//  that is evaluated column-wise over the facts of a batch. Join state
+//  lives in open-addressed tables whose chains are carved from an
+//  arena. Compares against an interpreter that tests every rule on
+//  every boxed fact.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <bit>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define RULES_SSE2 1
+#endif
+#if defined(__GNUC__)
+# define RULES_PREFETCH(...) __builtin_prefetch(__VA_ARGS__)
+#else
+# define RULES_PREFETCH(...) (void)0
+#endif
+
+namespace rete {
+  struct Fact {
+    std::uint32_t key, seq;
+  };
+
+  struct Trade : Fact {
+    float price, qty;
+  };
+
+  struct Quote : Fact {
+    float bid, ask;
+  };
+
+  struct Login : Fact {
+    float risk, age;
+  };
+
+  /// The fields predicates may test, in field-index order.
+  template <typename T> struct Fields;
+
+  template <> struct Fields<Trade> {
+    static constexpr float Trade::* List[] {&Trade::price, &Trade::qty};
+  };
+
+  template <> struct Fields<Quote> {
+    static constexpr float Quote::* List[] {&Quote::bid, &Quote::ask};
+  };
+
+  template <> struct Fields<Login> {
+    static constexpr float Login::* List[] {&Login::risk, &Login::age};
+  };
+
+  enum class Cmp : std::uint8_t { Less, Greater };
+
+  struct Pred {
+    std::uint8_t field;
+    Cmp cmp;
+    float value;
+  };
+
+  /// A conjunction of predicates over one alternative, named by its id.
+  struct Pattern {
+    std::size_t type;
+    std::vector<Pred> preds;
+  };
+
+  /// Fires once per fact matching `left`, or, when `right` is present,
+  /// once per pair of matching facts with equal keys. Joined patterns
+  /// must name different alternatives.
+  struct Rule {
+    Pattern left;
+    std::optional<Pattern> right;
+  };
+
+  /// Clears the bits of `Mask` whose column value fails `X Cmp V`.
+  /// `Col` is 16-byte aligned and readable up to a multiple of 64.
+  inline void testColumn(const float* Col, std::size_t Words, Cmp C,
+                         float V, std::uint64_t* Mask) {
+    for (std::size_t W = 0; W < Words; ++W) {
+      const float* X = Col + W * 64;
+      std::uint64_t Bits = 0;
+#ifdef RULES_SSE2
+      const __m128 Vs = _mm_set1_ps(V);
+      for (unsigned I = 0; I < 64; I += 4) {
+        const __m128 Xs = _mm_load_ps(X + I);
+        const __m128 In = (C == Cmp::Less)
+          ? _mm_cmplt_ps(Xs, Vs) : _mm_cmpgt_ps(Xs, Vs);
+        Bits |= std::uint64_t(_mm_movemask_ps(In)) << I;
+      }
+#else
+      for (unsigned I = 0; I < 64; ++I)
+        Bits |= std::uint64_t(C == Cmp::Less ? X[I] < V : X[I] > V) << I;
+#endif
+      Mask[W] &= Bits;
+    }
+  }
+
+  inline std::uint64_t mix(std::uint32_t L, std::uint32_t R) {
+    return std::uint64_t(L) * 0x9E3779B97F4A7C15ull + R;
+  }
+
+  /// Bump allocator. `reset` rewinds but keeps the chunks.
+  class Arena {
+    static constexpr std::size_t ChunkSize = std::size_t(1) << 20;
+  public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    ~Arena() {
+      for (auto* C : chunks_)
+        std::free(C);
+    }
+
+    void* allocate(std::size_t N, std::size_t Align) {
+      std::size_t Off = (used_ + Align - 1) & ~(Align - 1);
+      if (Off + N > ChunkSize) {
+        ++current_;
+        Off = 0;
+      }
+      if (current_ == chunks_.size())
+        chunks_.push_back(static_cast<std::uint8_t*>(std::malloc(ChunkSize)));
+      used_ = Off + N;
+      return chunks_[current_] + Off;
+    }
+
+    void reset() { current_ = used_ = 0; }
+
+  private:
+    std::vector<std::uint8_t*> chunks_;
+    std::size_t current_ = 0, used_ = 0;
+  };
+
+  /// Beta memory for one pattern: key -> chain of fact sequence numbers.
+  /// Slots are stamped with a generation so `clear` is O(1).
+  class JoinTable {
+  public:
+    struct Entry {
+      std::uint32_t seq;
+      const Entry* next;
+    };
+
+    const Entry* find(std::uint32_t Key) const {
+      if (slots_.empty())
+        return nullptr;
+      const std::size_t Mask = slots_.size() - 1;
+      for (std::size_t I = hash(Key) & Mask;; I = (I + 1) & Mask) {
+        const Slot& S = slots_[I];
+        if (S.gen != gen_)
+          return nullptr;
+        if (S.key == Key)
+          return S.head;
+      }
+    }
+
+    /// Starts loading the home slot of `Key`.
+    void prefetch(std::uint32_t Key) const {
+      if (!slots_.empty())
+        RULES_PREFETCH(&slots_[hash(Key) & (slots_.size() - 1)]);
+    }
+
+    void insert(std::uint32_t Key, std::uint32_t Seq, Arena& A) {
+      if (2 * (used_ + 1) > slots_.size())
+        this->grow();
+      Slot& S = this->probe(Key);
+      if (S.gen != gen_) {
+        S = {Key, gen_, nullptr};
+        ++used_;
+      }
+      S.head = new (A.allocate(sizeof(Entry), alignof(Entry)))
+        Entry {Seq, S.head};
+    }
+
+    void clear() {
+      ++gen_;
+      used_ = 0;
+    }
+
+  private:
+    struct Slot {
+      std::uint32_t key, gen;
+      const Entry* head;
+    };
+
+    static std::size_t hash(std::uint32_t Key) {
+      return std::size_t(Key * 0x9E3779B1u);
+    }
+
+    Slot& probe(std::uint32_t Key) {
+      const std::size_t Mask = slots_.size() - 1;
+      for (std::size_t I = hash(Key) & Mask;; I = (I + 1) & Mask) {
+        Slot& S = slots_[I];
+        if (S.gen != gen_ || S.key == Key)
+          return S;
+      }
+    }
+
+    void grow() {
+      std::vector<Slot> Old(std::max<std::size_t>(16, slots_.size() * 2));
+      Old.swap(slots_);
+      for (const Slot& S : Old)
+        if (S.gen == gen_)
+          this->probe(S.key) = S;
+    }
+
+    std::vector<Slot> slots_;
+    std::uint32_t gen_ = 1;
+    std::size_t used_ = 0;
+  };
+
+  template <typename...Ts>
+  class Network {
+    static constexpr std::uint32_t NoMemory = ~std::uint32_t(0);
+  public:
+    using FactPoly = efl::Poly<Fact, Ts...>;
+    static constexpr std::size_t MaxBatch = 1024;
+
+    Network()
+     : order_(new std::uint32_t[MaxBatch]),
+       columns_(new float[MaxBatch * MaxFields]()),
+       keys_(new std::uint32_t[MaxBatch]),
+       seqs_(new std::uint32_t[MaxBatch]) {}
+
+    std::size_t addRule(const Rule& R) {
+      const std::size_t Index = rules_.size();
+      const std::uint32_t Left = this->addCond(R.left, Index, true);
+      const std::uint32_t Right = R.right
+        ? this->addCond(*R.right, Index, false) : NoMemory;
+      rules_.push_back({Left, Right, 0});
+      return Index;
+    }
+
+    /// Matches a batch of at most `MaxBatch` facts.
+    void insert(std::span<const FactPoly> Batch) {
+      constexpr std::size_t Ids = FactPoly::Size() + 1;
+      std::uint32_t Begin[Ids + 1] {};
+      for (const FactPoly& F : Batch)
+        ++Begin[F.typeId() + 1];
+      for (std::size_t I = 1; I <= Ids; ++I)
+        Begin[I] += Begin[I - 1];
+      std::uint32_t Fill[Ids];
+      std::copy(Begin, Begin + Ids, Fill);
+      for (std::size_t K = 0; K < Batch.size(); ++K)
+        order_[Fill[Batch[K].typeId()]++] = std::uint32_t(K);
+      (this->matchType<Ts>(Batch, Begin), ...);
+    }
+
+    /// Drops all join state, e.g. at the end of a window.
+    void clear() {
+      for (JoinTable& M : memories_)
+        M.clear();
+      arena_.reset();
+    }
+
+    std::size_t rules() const { return rules_.size(); }
+    std::uint64_t fired(std::size_t R) const { return rules_[R].fired; }
+    std::uint64_t checksum() const { return checksum_; }
+
+  private:
+    static constexpr std::size_t MaxFields =
+      std::max({std::size(Fields<Ts>::List)...});
+
+    /// One alpha node: a predicate range feeding one beta memory.
+    struct Cond {
+      std::uint32_t firstPred, lastPred, memory, rule;
+      bool left;
+    };
+
+    /// Everything tested against facts of one alternative.
+    struct TypeAlpha {
+      std::vector<Pred> preds;
+      std::vector<Cond> conds;
+    };
+
+    struct RuleState {
+      std::uint32_t left, right;
+      std::uint64_t fired;
+    };
+
+    std::uint32_t addCond(const Pattern& P, std::size_t Rule, bool Left) {
+      TypeAlpha& A = alpha_[P.type];
+      Cond C;
+      C.firstPred = std::uint32_t(A.preds.size());
+      A.preds.insert(A.preds.end(), P.preds.begin(), P.preds.end());
+      C.lastPred = std::uint32_t(A.preds.size());
+      C.memory = std::uint32_t(memories_.size());
+      C.rule = std::uint32_t(Rule);
+      C.left = Left;
+      A.conds.push_back(C);
+      memories_.emplace_back();
+      return C.memory;
+    }
+
+    template <typename T>
+    void matchType(std::span<const FactPoly> Batch,
+                   const std::uint32_t* Begin) {
+      constexpr std::size_t Id = FactPoly::template IdOf<T>();
+      const TypeAlpha& A = alpha_[Id];
+      const std::size_t N = Begin[Id + 1] - Begin[Id];
+      if (N == 0 || A.conds.empty())
+        return;
+
+      // Transpose the group so each predicate is a tight column loop.
+      constexpr auto& List = Fields<T>::List;
+      for (std::size_t I = 0; I < N; ++I) {
+        const T& F = Batch[order_[Begin[Id] + I]].template getUnchecked<T>();
+        keys_[I] = F.key;
+        seqs_[I] = F.seq;
+        for (std::size_t K = 0; K < std::size(List); ++K)
+          columns_[K * MaxBatch + I] = F.*List[K];
+      }
+
+      const std::size_t Words = (N + 63) / 64;
+      std::uint64_t Live[MaxBatch / 64], Mask[MaxBatch / 64];
+      for (std::size_t W = 0; W < Words; ++W)
+        Live[W] = (N - W * 64 >= 64) ? ~0ull : (1ull << (N - W * 64)) - 1;
+      for (const Cond& C : A.conds) {
+        std::copy_n(Live, Words, Mask);
+        for (std::uint32_t P = C.firstPred; P < C.lastPred; ++P) {
+          const Pred& Q = A.preds[P];
+          testColumn(columns_.get() + Q.field * MaxBatch, Words, Q.cmp,
+            Q.value, Mask);
+        }
+        // Activations of one condition hit two tables at random slots;
+        // issue all the loads before walking any of them.
+        std::uint32_t Sel[MaxBatch], M = 0;
+        for (std::size_t W = 0; W < Words; ++W)
+          for (std::uint64_t Bits = Mask[W]; Bits; Bits &= Bits - 1)
+            Sel[M++] = std::uint32_t(W * 64 + std::countr_zero(Bits));
+        const RuleState& R = rules_[C.rule];
+        if (R.right != NoMemory) {
+          const JoinTable& Other = memories_[C.left ? R.right : R.left];
+          for (std::uint32_t K = 0; K < M; ++K) {
+            Other.prefetch(keys_[Sel[K]]);
+            memories_[C.memory].prefetch(keys_[Sel[K]]);
+          }
+        }
+        for (std::uint32_t K = 0; K < M; ++K)
+          this->activate(C, keys_[Sel[K]], seqs_[Sel[K]]);
+      }
+    }
+
+    void activate(const Cond& C, std::uint32_t Key, std::uint32_t Seq) {
+      RuleState& R = rules_[C.rule];
+      if (R.right == NoMemory) {
+        ++R.fired;
+        checksum_ += Seq;
+        return;
+      }
+      const std::uint32_t Other = C.left ? R.right : R.left;
+      for (auto* E = memories_[Other].find(Key); E; E = E->next) {
+        ++R.fired;
+        checksum_ += C.left ? mix(Seq, E->seq) : mix(E->seq, Seq);
+      }
+      memories_[C.memory].insert(Key, Seq, arena_);
+    }
+
+    TypeAlpha alpha_[FactPoly::Size() + 1];
+    std::vector<RuleState> rules_;
+    std::vector<JoinTable> memories_;
+    Arena arena_;
+    std::uint64_t checksum_ = 0;
+    std::unique_ptr<std::uint32_t[]> order_;
+    std::unique_ptr<float[]> columns_;
+    std::unique_ptr<std::uint32_t[]> keys_, seqs_;
+  };
+} // namespace rete
+
+#undef RULES_PREFETCH
+
+using Net = rete::Network<rete::Trade, rete::Quote, rete::Login>;
+using FactPoly = Net::FactPoly;
+
+//=== Interpreted Baseline ===//
+
+namespace naive {
+  struct Fact {
+    virtual ~Fact() = default;
+    virtual std::size_t type() const = 0;
+    virtual float field(std::size_t I) const = 0;
+    std::uint32_t key = 0, seq = 0;
+  };
+
+  template <typename T>
+  struct Boxed : Fact {
+    explicit Boxed(const T& V) : value(V) {
+      key = V.key;
+      seq = V.seq;
+    }
+    std::size_t type() const override {
+      return FactPoly::IdOf<T>();
+    }
+    float field(std::size_t I) const override {
+      return value.*rete::Fields<T>::List[I];
+    }
+    T value;
+  };
+
+  /// Tests every pattern of every rule against each fact in turn.
+  class Engine {
+  public:
+    explicit Engine(const std::vector<rete::Rule>& Rules)
+     : rules_(Rules), left_(Rules.size()), right_(Rules.size()),
+       fired_(Rules.size()) {}
+
+    void insert(const Fact& F) {
+      for (std::size_t R = 0; R < rules_.size(); ++R) {
+        const rete::Rule& Rule = rules_[R];
+        if (matches(Rule.left, F)) {
+          if (!Rule.right) {
+            ++fired_[R];
+            checksum_ += F.seq;
+            continue;
+          }
+          auto [B, E] = right_[R].equal_range(F.key);
+          for (; B != E; ++B, ++fired_[R])
+            checksum_ += rete::mix(F.seq, B->second);
+          left_[R].emplace(F.key, F.seq);
+        } else if (Rule.right && matches(*Rule.right, F)) {
+          auto [B, E] = left_[R].equal_range(F.key);
+          for (; B != E; ++B, ++fired_[R])
+            checksum_ += rete::mix(B->second, F.seq);
+          right_[R].emplace(F.key, F.seq);
+        }
+      }
+    }
+
+    void clear() {
+      for (auto& M : left_)
+        M.clear();
+      for (auto& M : right_)
+        M.clear();
+    }
+
+    std::uint64_t fired(std::size_t R) const { return fired_[R]; }
+    std::uint64_t checksum() const { return checksum_; }
+
+  private:
+    static bool matches(const rete::Pattern& P, const Fact& F) {
+      if (F.type() != P.type)
+        return false;
+      for (const rete::Pred& Q : P.preds) {
+        const float X = F.field(Q.field);
+        if (Q.cmp == rete::Cmp::Less ? !(X < Q.value) : !(X > Q.value))
+          return false;
+      }
+      return true;
+    }
+
+    using Memory = std::unordered_multimap<std::uint32_t, std::uint32_t>;
+    std::vector<rete::Rule> rules_;
+    std::vector<Memory> left_, right_;
+    std::vector<std::uint64_t> fired_;
+    std::uint64_t checksum_ = 0;
+  };
+} // namespace naive
+
+//=== Benchmark ===//
+
+static constexpr std::size_t Types = FactPoly::Size() - 1;
+
+static std::vector<rete::Rule> makeRules(std::size_t N, bench::Rng& R) {
+  auto Pat = [&R] (std::size_t Type) {
+    rete::Pattern P {Type + 2, {}};
+    for (std::size_t K = 0, E = 2 + R.below(2); K < E; ++K)
+      P.preds.push_back({std::uint8_t(R.below(2)),
+        R.below(2) ? rete::Cmp::Less : rete::Cmp::Greater,
+        float(R.below(100))});
+    return P;
+  };
+  std::vector<rete::Rule> Rules;
+  for (std::size_t I = 0; I < N; ++I) {
+    const std::size_t L = R.below(Types);
+    rete::Rule Rule {Pat(L), std::nullopt};
+    if (R.below(8) != 0)
+      Rule.right = Pat((L + 1 + R.below(Types - 1)) % Types);
+    Rules.push_back(std::move(Rule));
+  }
+  return Rules;
+}
+
+static std::vector<FactPoly> makeFacts(std::size_t N, bench::Rng& R) {
+  std::vector<FactPoly> Facts(N);
+  for (std::size_t I = 0; I < N; ++I) {
+    const rete::Fact Base {std::uint32_t(R.below(1024)), std::uint32_t(I)};
+    const float A = float(R.below(100)), B = float(R.below(100));
+    switch (R.below(Types)) {
+     case 0:  Facts[I] = rete::Trade{Base, A, B}; break;
+     case 1:  Facts[I] = rete::Quote{Base, A, B}; break;
+     default: Facts[I] = rete::Login{Base, A, B}; break;
+    }
+  }
+  return Facts;
+}
+
+int main(int Argc, char** Argv) {
+  const std::size_t N = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 200'000;
+  const std::size_t Batch = 256, Window = 4096;
+  bench::Rng R;
+  const std::vector<FactPoly> Facts = makeFacts(N, R);
+
+  std::vector<std::unique_ptr<naive::Fact>> Boxed;
+  for (const FactPoly& F : Facts)
+    F.visit([&] <typename T> (const T* P) {
+      if constexpr (!std::same_as<T, rete::Fact>)
+        Boxed.push_back(std::make_unique<naive::Boxed<T>>(*P));
+    });
+
+  std::printf("facts: %zu, batch %zu, window %zu\n", N, Batch, Window);
+  for (std::size_t RuleCount : {16, 128, 512}) {
+    const std::vector<rete::Rule> Rules = makeRules(RuleCount, R);
+
+    Net Network;
+    for (const rete::Rule& Rule : Rules)
+      (void) Network.addRule(Rule);
+    const auto T0 = bench::Clock::now();
+    for (std::size_t Off = 0; Off < N; Off += Batch) {
+      if (Off % Window == 0)
+        Network.clear();
+      Network.insert(std::span(Facts).subspan(Off, std::min(Batch, N - Off)));
+    }
+    const double NetSecs = bench::secondsSince(T0);
+
+    naive::Engine Engine {Rules};
+    const auto T1 = bench::Clock::now();
+    for (std::size_t I = 0; I < N; ++I) {
+      if (I % Window == 0)
+        Engine.clear();
+      Engine.insert(*Boxed[I]);
+    }
+    const double NaiveSecs = bench::secondsSince(T1);
+
+    std::uint64_t Fired = 0;
+    for (std::size_t I = 0; I < Rules.size(); ++I) {
+      if (Network.fired(I) != Engine.fired(I)) {
+        std::fprintf(stderr, "rule %zu: %llu != %llu\n", I,
+          (unsigned long long)Network.fired(I),
+          (unsigned long long)Engine.fired(I));
+        return 1;
+      }
+      Fired += Network.fired(I);
+    }
+    if (Network.checksum() != Engine.checksum()) {
+      std::fprintf(stderr, "checksum mismatch\n");
+      return 1;
+    }
+    std::printf("%4zu rules  %-12s %7.2f M facts/s  (%llu firings)\n",
+      RuleCount, "alpha net", double(N) / NetSecs / 1e6,
+      (unsigned long long)Fired);
+    std::printf("%4zu rules  %-12s %7.2f M facts/s\n",
+      RuleCount, "interpreted", double(N) / NaiveSecs / 1e6);
+  }
+}
@@ -0,0 +1,304 @@
+//===- Serialize.cpp ------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Encodes and decodes a log of Poly events, some owning strings and
+//  vectors, with efl::wire, compared to a space-separated text format
+//  written with std::to_chars and parsed with std::from_chars. Reports
+//  encoded size and throughput over the encoded bytes.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <Poly/Serialize.hpp>
+#include <charconv>
+#include <string>
+#include <vector>
+
+struct Event {};
+
+struct Click : Event {
+  std::uint32_t x, y;
+  std::int32_t dx;
+};
+
+struct Key : Event {
+  std::uint16_t code;
+  bool shift;
+};
+
+struct Message : Event {
+  std::uint64_t user;
+  std::string text;
+};
+
+struct Trace : Event {
+  std::string name;
+  std::vector<float> samples;
+  std::vector<std::int64_t> deltas;
+};
+
+template <> struct efl::wire::Fields<Click> {
+  static constexpr std::tuple List {&Click::x, &Click::y, &Click::dx};
+};
+
+template <> struct efl::wire::Fields<Key> {
+  static constexpr std::tuple List {&Key::code, &Key::shift};
+};
+
+template <> struct efl::wire::Fields<Message> {
+  static constexpr std::tuple List {&Message::user, &Message::text};
+};
+
+template <> struct efl::wire::Fields<Trace> {
+  static constexpr std::tuple List {
+    &Trace::name, &Trace::samples, &Trace::deltas};
+};
+
+using EventPoly = efl::Poly<Event, Click, Key, Message, Trace>;
+
+static bool same(const Click& A, const Click& B) {
+  return A.x == B.x && A.y == B.y && A.dx == B.dx;
+}
+static bool same(const Key& A, const Key& B) {
+  return A.code == B.code && A.shift == B.shift;
+}
+static bool same(const Message& A, const Message& B) {
+  return A.user == B.user && A.text == B.text;
+}
+static bool same(const Trace& A, const Trace& B) {
+  return A.name == B.name && A.samples == B.samples
+    && A.deltas == B.deltas;
+}
+
+static bool same(const std::vector<EventPoly>& A,
+                 const std::vector<EventPoly>& B) {
+  if (A.size() != B.size())
+    return false;
+  for (std::size_t I = 0; I < A.size(); ++I) {
+    bool Eq = A[I].typeId() == B[I].typeId();
+    A[I].visit([&] <typename T> (const T* X) {
+      if constexpr (!std::same_as<T, Event>)
+        Eq = Eq && same(*X, B[I].getUnchecked<T>());
+    });
+    if (!Eq)
+      return false;
+  }
+  return true;
+}
+
+static void populate(std::vector<EventPoly>& Out, std::size_t N) {
+  bench::Rng R;
+  for (std::size_t I = 0; I < N; ++I) {
+    const std::uint32_t K = R.below(100);
+    if (K < 45) {
+      Out.emplace_back(Click{{}, R.below(1920), R.below(1080),
+        std::int32_t(R.below(64)) - 32});
+    } else if (K < 80) {
+      Out.emplace_back(Key{{}, std::uint16_t(R.below(256)),
+        R.below(4) == 0});
+    } else if (K < 95) {
+      Out.emplace_back(Message{{}, 100'000 + R.below(50'000),
+        "user typed message #" + std::to_string(I)});
+    } else {
+      Trace T {{}, "span/" + std::to_string(R.below(64)), {}, {}};
+      for (std::uint32_t S = 0, E = 4 + R.below(12); S < E; ++S) {
+        T.samples.push_back(float(R.unit()));
+        T.deltas.push_back(std::int64_t(R.below(2000)) - 1000);
+      }
+      Out.emplace_back(std::move(T));
+    }
+  }
+}
+
+//=== Text Baseline ===//
+
+namespace text {
+  struct Out {
+    void put(auto V) {
+      char Buf[32];
+      const auto [End, Ec] = std::to_chars(Buf, Buf + sizeof(Buf), V);
+      s.append(Buf, End);
+      s.push_back(' ');
+    }
+    void put(const std::string& V) {
+      this->put(V.size());
+      s.append(V);
+      s.push_back(' ');
+    }
+    std::string s;
+  };
+
+  struct In {
+    template <typename T>
+    bool get(T& V) {
+      if constexpr (std::same_as<T, bool>) {
+        int B;
+        if (!this->get(B))
+          return false;
+        V = B != 0;
+        return true;
+      } else {
+        const auto [Ptr, Ec] = std::from_chars(p, end, V);
+        if (Ec != std::errc() || Ptr == end)
+          return false;
+        p = Ptr + 1;
+        return true;
+      }
+    }
+    bool get(std::string& V) {
+      std::size_t N;
+      if (!this->get(N) || std::size_t(end - p) < N + 1)
+        return false;
+      V.assign(p, N);
+      p += N + 1;
+      return true;
+    }
+    const char* p;
+    const char* end;
+  };
+
+  static void encode(Out& O, const std::vector<EventPoly>& S) {
+    O.put(S.size());
+    for (const EventPoly& E : S) {
+      O.put(E.typeId());
+      if (const Click* C = E.getIf<Click>()) {
+        O.put(C->x), O.put(C->y), O.put(C->dx);
+      } else if (const Key* K = E.getIf<Key>()) {
+        O.put(K->code), O.put(int(K->shift));
+      } else if (const Message* M = E.getIf<Message>()) {
+        O.put(M->user), O.put(M->text);
+      } else if (const Trace* T = E.getIf<Trace>()) {
+        O.put(T->name);
+        O.put(T->samples.size());
+        for (float F : T->samples)
+          O.put(F);
+        O.put(T->deltas.size());
+        for (std::int64_t D : T->deltas)
+          O.put(D);
+      }
+    }
+  }
+
+  template <typename T>
+  static bool getVector(In& I, std::vector<T>& V) {
+    std::size_t N;
+    if (!I.get(N))
+      return false;
+    V.resize(N);
+    for (T& X : V) {
+      if (!I.get(X))
+        return false;
+    }
+    return true;
+  }
+
+  static bool decode(In& I, std::vector<EventPoly>& Out) {
+    std::size_t N, Id;
+    if (!I.get(N))
+      return false;
+    Out.reserve(N);
+    for (std::size_t K = 0; K < N; ++K) {
+      if (!I.get(Id))
+        return false;
+      bool Ok = false;
+      if (Id == EventPoly::IdOf<Click>()) {
+        Click& C = Out.emplace_back().emplace<Click>();
+        Ok = I.get(C.x) && I.get(C.y) && I.get(C.dx);
+      } else if (Id == EventPoly::IdOf<Key>()) {
+        Key& C = Out.emplace_back().emplace<Key>();
+        Ok = I.get(C.code) && I.get(C.shift);
+      } else if (Id == EventPoly::IdOf<Message>()) {
+        Message& M = Out.emplace_back().emplace<Message>();
+        Ok = I.get(M.user) && I.get(M.text);
+      } else if (Id == EventPoly::IdOf<Trace>()) {
+        Trace& T = Out.emplace_back().emplace<Trace>();
+        Ok = I.get(T.name) && getVector(I, T.samples)
+          && getVector(I, T.deltas);
+      }
+      if (!Ok)
+        return false;
+    }
+    return true;
+  }
+} // namespace text
+
+//=== Benchmark ===//
+
+int main(int Argc, char** Argv) {
+  const std::size_t N = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 1'000'000;
+  const int Rounds = 5;
+  std::vector<EventPoly> Src;
+  populate(Src, N);
+
+  double WireEnc = 1e9, WireDec = 1e9, TextEnc = 1e9, TextDec = 1e9;
+  std::size_t WireBytes = 0, TextBytes = 0;
+  // Buffers are reused across rounds so page faults are paid once.
+  efl::wire::Writer W;
+  text::Out O;
+  std::vector<EventPoly> Back, TextBack;
+  for (int Round = 0; Round < Rounds; ++Round) {
+    W.clear();
+    auto T0 = bench::Clock::now();
+    efl::wire::encodeAll(W, Src);
+    WireEnc = std::min(WireEnc, bench::secondsSince(T0));
+    WireBytes = W.size();
+
+    Back.clear();
+    efl::wire::Reader R(W.data());
+    T0 = bench::Clock::now();
+    const bool Ok = efl::wire::decodeAll(R, Back);
+    WireDec = std::min(WireDec, bench::secondsSince(T0));
+    if (!Ok || !R.atEnd() || !same(Src, Back)) {
+      std::fprintf(stderr, "wire: round trip mismatch\n");
+      return 1;
+    }
+
+    O.s.clear();
+    T0 = bench::Clock::now();
+    text::encode(O, Src);
+    TextEnc = std::min(TextEnc, bench::secondsSince(T0));
+    TextBytes = O.s.size();
+
+    TextBack.clear();
+    text::In I {O.s.data(), O.s.data() + O.s.size()};
+    T0 = bench::Clock::now();
+    const bool TextOk = text::decode(I, TextBack);
+    TextDec = std::min(TextDec, bench::secondsSince(T0));
+    if (!TextOk || !same(Src, TextBack)) {
+      std::fprintf(stderr, "text: round trip mismatch\n");
+      return 1;
+    }
+  }
+
+  // Throughput is over the bytes each format produces, and over events.
+  auto Row = [N] (const char* Name, std::size_t Bytes, double Enc,
+                  double Dec) {
+    std::printf("%-6s %10.2f MiB %8.1f B/ev %9.1f MB/s %8.2f Mev/s"
+      " %9.1f MB/s %8.2f Mev/s\n", Name, double(Bytes) / (1 << 20),
+      double(Bytes) / double(N), double(Bytes) / Enc * 1e-6,
+      double(N) / Enc * 1e-6, double(Bytes) / Dec * 1e-6,
+      double(N) / Dec * 1e-6);
+  };
+  std::printf("events: %zu, best of %d\n", N, Rounds);
+  std::printf("%-6s %14s %13s %28s %28s\n", "format", "size", "",
+    "encode", "decode");
+  Row("wire", WireBytes, WireEnc, WireDec);
+  Row("text", TextBytes, TextEnc, TextDec);
+}
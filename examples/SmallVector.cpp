@@ -0,0 +1,151 @@
+//===- SmallVector.cpp ----------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A request path that builds a short list of Poly directives per
+//  request, evaluates it, keeps a copy for the response and drops both.
+//  Compares std::vector to efl::SmallPolyVector<8> for a trivially
+//  copyable set and for a set with a string, reporting allocations per
+//  request and per-request latency.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <Poly/SmallVector.hpp>
+#include <string>
+#include <vector>
+
+struct Directive {};
+
+struct Header : Directive {
+  std::uint32_t key, value;
+};
+
+struct Route : Directive {
+  std::uint32_t service;
+  std::uint16_t port;
+};
+
+struct Limit : Directive {
+  std::uint64_t bytes;
+  float rate;
+};
+
+/// Short enough for the small-string buffer; moving it is not memcpy.
+struct Note : Directive {
+  std::string text;
+};
+
+using PlainPoly = efl::Poly<Directive, Header, Route, Limit>;
+using MixedPoly = efl::Poly<Directive, Header, Route, Limit, Note>;
+
+using PlainSmall = efl::SmallPolyVector<8, Directive, Header, Route, Limit>;
+using MixedSmall =
+  efl::SmallPolyVector<8, Directive, Header, Route, Limit, Note>;
+
+/// Most requests carry 2-6 directives, some up to 8, a few spill.
+static std::uint32_t directivesFor(bench::Rng& R) {
+  const std::uint32_t K = R.below(100);
+  if (K < 70)
+    return 2 + R.below(5);
+  if (K < 95)
+    return 7 + R.below(2);
+  return 9 + R.below(8);
+}
+
+template <typename P, typename L>
+static std::uint64_t serve(L& List, bench::Rng& R) {
+  const std::uint32_t N = directivesFor(R);
+  for (std::uint32_t I = 0; I < N; ++I) {
+    switch (R.below(4)) {
+     case 0:  List.emplace_back(Header{{}, I, R.below(1000)}); break;
+     case 1:  List.emplace_back(Route{{}, R.below(64), 8080}); break;
+     case 2:  List.emplace_back(Limit{{}, 1u << 20, 0.5f}); break;
+     default:
+      if constexpr (std::same_as<P, MixedPoly>)
+        List.emplace_back(Note{{}, "cache:miss"});
+      else
+        List.emplace_back(Header{{}, ~I, 0});
+    }
+  }
+
+  std::uint64_t Score = 0;
+  for (const P& D : List) {
+    D.visit([&Score] <typename T> (const T* X) {
+      if constexpr (std::same_as<T, Header>)
+        Score += X->value;
+      else if constexpr (std::same_as<T, Route>)
+        Score += X->service + X->port;
+      else if constexpr (std::same_as<T, Limit>)
+        Score += std::uint64_t(X->rate * 10);
+      else if constexpr (std::same_as<T, Note>)
+        Score += X->text.size();
+    });
+  }
+
+  // The response keeps its own copy.
+  const L Response(List);
+  Score += Response.size();
+  return Score;
+}
+
+template <typename P, typename L>
+static std::uint64_t run(const char* Name, std::size_t Requests) {
+  bench::Rng R;
+  std::vector<std::uint64_t> Ns;
+  Ns.reserve(Requests);
+  std::uint64_t Score = 0;
+  const std::size_t Before = bench::allocs();
+  for (std::size_t K = 0; K < Requests; ++K) {
+    const auto T0 = bench::Clock::now();
+    {
+      L List;
+      Score += serve<P>(List, R);
+    }
+    Ns.push_back(std::uint64_t(
+      std::chrono::nanoseconds(bench::Clock::now() - T0).count()));
+  }
+  // The latency vector was reserved up front.
+  const std::size_t Allocs = bench::allocs() - Before;
+  std::printf("%-20s %6.2f allocs/request\n", Name,
+    double(Allocs) / double(Requests));
+  bench::printLatency(Name, Ns);
+  return Score;
+}
+
+//=== Benchmark ===//
+
+int main(int Argc, char** Argv) {
+  const std::size_t Requests = Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 2'000'000;
+  std::printf("requests: %zu, inline capacity: %zu\n", Requests,
+    PlainSmall::InlineCapacity());
+
+  const std::uint64_t A = run<PlainPoly, std::vector<PlainPoly>>(
+    "plain vector", Requests);
+  const std::uint64_t B = run<PlainPoly, PlainSmall>(
+    "plain small", Requests);
+  const std::uint64_t C = run<MixedPoly, std::vector<MixedPoly>>(
+    "mixed vector", Requests);
+  const std::uint64_t D = run<MixedPoly, MixedSmall>(
+    "mixed small", Requests);
+  if (A != B || C != D) {
+    std::fprintf(stderr, "score mismatch\n");
+    return 1;
+  }
+}
@@ -0,0 +1,155 @@
+//===- TieredVector.cpp ---------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  Fills, scans and updates an efl::TieredPolyVector whose dataset is
+//  a growing multiple of its resident budget, next to a std::vector of
+//  the same Poly values. The scan prefetches ahead; the random pass
+//  sends 90% of accesses to a 10% hot set and writes one in ten.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <Poly/TieredVector.hpp>
+#include <string>
+#include <vector>
+
+struct Sample {};
+
+struct Count : Sample {
+  std::uint64_t n;
+};
+
+struct Reading : Sample {
+  float value, weight;
+};
+
+struct Span : Sample {
+  std::uint32_t lo, hi;
+};
+
+using SamplePoly = efl::Poly<Sample, Count, Reading, Span>;
+using Tiered = efl::TieredPolyVector<Sample, Count, Reading, Span>;
+
+static SamplePoly make(std::size_t I) {
+  switch (I % 3) {
+   case 0:  return Count{{}, I};
+   case 1:  return Reading{{}, float(I & 1023), 0.5f};
+   default: return Span{{}, std::uint32_t(I), std::uint32_t(I + 7)};
+  }
+}
+
+static std::uint64_t weigh(const SamplePoly& P) {
+  std::uint64_t W = 0;
+  P.visit([&W] <typename T> (const T* X) {
+    if constexpr (std::same_as<T, Count>)
+      W = X->n;
+    else if constexpr (std::same_as<T, Reading>)
+      W = std::uint64_t(X->value * X->weight);
+    else if constexpr (std::same_as<T, Span>)
+      W = X->hi - X->lo;
+  });
+  return W;
+}
+
+static void bump(SamplePoly& P) {
+  if (Count* C = P.getIf<Count>())
+    ++C->n;
+}
+
+struct Result {
+  double fill, scan, random;
+  std::uint64_t sum;
+};
+
+/// Skewed indices: 90% fall in the first tenth of `[0, N)`.
+static std::size_t pick(bench::Rng& R, std::size_t N) {
+  const std::size_t Hot = std::max<std::size_t>(1, N / 10);
+  return R.below(10) != 0 ? R.below(std::uint32_t(Hot))
+                          : R.below(std::uint32_t(N));
+}
+
+template <typename V>
+static Result run(V& Vec, std::size_t N, std::size_t Ops) {
+  Result Res {};
+  auto T0 = bench::Clock::now();
+  for (std::size_t I = 0; I < N; ++I)
+    Vec.push_back(make(I));
+  Res.fill = bench::secondsSince(T0);
+
+  const V& CVec = Vec;
+  constexpr std::size_t Ahead = Tiered::PageSize * 16;
+  T0 = bench::Clock::now();
+  for (std::size_t I = 0; I < N; ++I) {
+    if constexpr (std::same_as<V, Tiered>) {
+      if (I % Ahead == 0)
+        CVec.prefetch(I + Ahead, I + 2 * Ahead);
+    }
+    Res.sum += weigh(CVec[I]);
+  }
+  Res.scan = bench::secondsSince(T0);
+
+  bench::Rng R;
+  T0 = bench::Clock::now();
+  for (std::size_t K = 0; K < Ops; ++K) {
+    const std::size_t I = pick(R, N);
+    if (K % 10 == 0)
+      bump(Vec[I]);
+    else
+      Res.sum += weigh(CVec[I]);
+  }
+  Res.random = bench::secondsSince(T0);
+  return Res;
+}
+
+//=== Benchmark ===//
+
+int main(int Argc, char** Argv) {
+  const std::size_t Resident = (Argc > 1
+    ? std::strtoull(Argv[1], nullptr, 10) : 64) << 20;
+  const std::size_t Ops = Argc > 2
+    ? std::strtoull(Argv[2], nullptr, 10) : 4'000'000;
+  const std::string Path = Argc > 3 ? Argv[3] : "poly-tiered.bin";
+
+  std::printf("resident: %zu MiB, %zu-byte elements, %zu random ops\n",
+    Resident >> 20, sizeof(SamplePoly), Ops);
+  std::printf("%-6s %-8s %10s %12s %12s %10s %10s\n", "ratio", "store",
+    "fill ms", "scan M/s", "random M/s", "misses", "writeback");
+  for (double Ratio : {0.5, 1.0, 2.0, 4.0, 8.0}) {
+    const auto N = std::size_t(Ratio * double(Resident))
+      / sizeof(SamplePoly);
+
+    std::vector<SamplePoly> Flat;
+    const Result A = run(Flat, N, Ops);
+    std::vector<SamplePoly>().swap(Flat);
+
+    Tiered Paged(Path.c_str(), Resident);
+    const Result B = run(Paged, N, Ops);
+    if (A.sum != B.sum) {
+      std::fprintf(stderr, "ratio %.1f: checksum mismatch\n", Ratio);
+      return 1;
+    }
+
+    std::printf("%-6.1f %-8s %10.1f %12.1f %12.1f %10s %10s\n", Ratio,
+      "vector", A.fill * 1e3, double(N) / A.scan * 1e-6,
+      double(Ops) / A.random * 1e-6, "-", "-");
+    std::printf("%-6.1f %-8s %10.1f %12.1f %12.1f %10zu %10zu\n", Ratio,
+      "tiered", B.fill * 1e3, double(N) / B.scan * 1e-6,
+      double(Ops) / B.random * 1e-6, Paged.misses(), Paged.writebacks());
+  }
+}
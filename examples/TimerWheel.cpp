@@ -0,0 +1,318 @@
+//===- TimerWheel.cpp -----------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  A hashed hierarchical timer wheel whose callbacks are stored inline
+//  as Poly values in pooled nodes. Schedule and cancel are O(1), and
+//  each expired slot is grouped by alternative before firing. Compares
+//  against a std::multimap of std::function.
+//
+//===----------------------------------------------------------------===//
+
+#include "Bench.hpp"
+#include <Poly/Poly.hpp>
+#include <functional>
+#include <map>
+#include <vector>
+
+struct Net {
+  std::uint64_t closed = 0, resent = 0, pings = 0, deadlines = 0;
+};
+
+struct Timeout {};
+
+struct CloseIdle : Timeout {
+  std::uint32_t conn;
+  void fire(Net& N) const { N.closed += conn & 1; }
+};
+
+struct Retransmit : Timeout {
+  std::uint32_t conn, seq;
+  void fire(Net& N) const { N.resent += seq != 0; }
+};
+
+struct KeepAlive : Timeout {
+  std::uint32_t conn;
+  std::uint64_t lastSeen;
+  void fire(Net& N) const { N.pings += lastSeen != conn; }
+};
+
+struct Deadline : Timeout {
+  void (*fn)(Net&, void*);
+  void* ctx;
+  void fire(Net& N) const { fn(N, ctx); }
+};
+
+using Callback = efl::Poly<Timeout,
+  CloseIdle, Retransmit, KeepAlive, Deadline>;
+
+template <typename...TT>
+struct TypeList {
+  template <typename F>
+  static void forEach(F&& Fn) { (Fn.template operator()<TT>(), ...); }
+};
+
+using Alternatives = TypeList<CloseIdle, Retransmit, KeepAlive, Deadline>;
+
+//=== Timer Wheel ===//
+
+class TimerWheel {
+  static constexpr unsigned Bits = 8;
+  static constexpr unsigned Slots = 1u << Bits;
+  static constexpr unsigned Levels = 4;
+  static constexpr std::uint32_t Nil = ~std::uint32_t(0);
+  static constexpr std::uint32_t Firing = Nil - 1;
+
+  struct Node {
+    Callback cb;
+    std::uint64_t expiry = 0;
+    std::uint32_t prev = Nil, next = Nil;
+    std::uint32_t slot = Nil;
+    std::uint32_t gen = 0;
+  };
+
+public:
+  struct Handle {
+    std::uint32_t index = Nil, gen = 0;
+  };
+
+  explicit TimerWheel(std::uint32_t Capacity)
+   : nodes_(Capacity), batch_(Capacity), sorted_(Capacity) {
+    for (auto& H : heads_)
+      H = Nil;
+    for (std::uint32_t I = 0; I < Capacity; ++I)
+      nodes_[I].next = (I + 1 < Capacity) ? I + 1 : Nil;
+    free_ = Capacity ? 0 : Nil;
+  }
+
+  std::uint64_t now() const { return now_; }
+
+  /// Fires `Cb` after `Delay` ticks. Returns an invalid handle if the
+  /// pool is exhausted.
+  template <typename T>
+  Handle schedule(std::uint64_t Delay, const T& Cb) {
+    if (free_ == Nil)
+      return {};
+    const std::uint32_t I = free_;
+    Node& N = nodes_[I];
+    free_ = N.next;
+    N.cb = Cb;
+    N.expiry = now_ + (Delay ? Delay : 1);
+    this->insert(I);
+    return {I, N.gen};
+  }
+
+  /// Cancels a pending timer. Stale handles and timers that are already
+  /// firing are ignored.
+  bool cancel(Handle H) {
+    if (H.index >= nodes_.size())
+      return false;
+    Node& N = nodes_[H.index];
+    if (N.gen != H.gen || N.slot == Nil || N.slot == Firing)
+      return false;
+    this->unlink(H.index);
+    this->release(H.index);
+    return true;
+  }
+
+  /// Advances to `To`, firing everything that expires on the way.
+  void advance(std::uint64_t To, Net& Ctx) {
+    while (now_ < To) {
+      ++now_;
+      for (unsigned L = 1; L < Levels; ++L) {
+        if ((now_ & ((std::uint64_t(1) << (Bits * L)) - 1)) != 0)
+          break;
+        this->cascade(L);
+      }
+      this->expire(std::uint32_t(now_ & (Slots - 1)), Ctx);
+    }
+  }
+
+private:
+  static unsigned slotFor(unsigned Level, std::uint64_t Expiry) {
+    return Level * Slots + unsigned((Expiry >> (Bits * Level)) & (Slots - 1));
+  }
+
+  void insert(std::uint32_t I) {
+    Node& N = nodes_[I];
+    const std::uint64_t Delta = N.expiry - now_;
+    unsigned Level = 0;
+    while (Level + 1 < Levels
+        && Delta >= (std::uint64_t(1) << (Bits * (Level + 1))))
+      ++Level;
+    const unsigned S = slotFor(Level, N.expiry);
+    N.slot = S;
+    N.prev = Nil;
+    N.next = heads_[S];
+    if (N.next != Nil)
+      nodes_[N.next].prev = I;
+    heads_[S] = I;
+  }
+
+  void unlink(std::uint32_t I) {
+    Node& N = nodes_[I];
+    (N.prev != Nil ? nodes_[N.prev].next : heads_[N.slot]) = N.next;
+    if (N.next != Nil)
+      nodes_[N.next].prev = N.prev;
+    N.slot = Nil;
+  }
+
+  void release(std::uint32_t I) {
+    Node& N = nodes_[I];
+    N.cb.erase();
+    N.slot = Nil;
+    ++N.gen;
+    N.next = free_;
+    free_ = I;
+  }
+
+  void cascade(unsigned Level) {
+    const unsigned S = slotFor(Level, now_);
+    std::uint32_t I = heads_[S];
+    heads_[S] = Nil;
+    while (I != Nil) {
+      const std::uint32_t Next = nodes_[I].next;
+      this->insert(I);
+      I = Next;
+    }
+  }
+
+  /// Detaches a level-0 slot, buckets it by alternative id, then runs
+  /// each bucket through a loop over the concrete type.
+  void expire(std::uint32_t S, Net& Ctx) {
+    std::uint32_t Count = 0;
+    std::uint32_t Counts[Callback::Size() + 2] {};
+    for (std::uint32_t I = heads_[S]; I != Nil; I = nodes_[I].next) {
+      nodes_[I].slot = Firing;
+      batch_[Count++] = I;
+      ++Counts[nodes_[I].cb.typeId() + 1];
+    }
+    heads_[S] = Nil;
+    if (Count == 0)
+      return;
+
+    for (std::size_t K = 1; K < std::size(Counts); ++K)
+      Counts[K] += Counts[K - 1];
+    std::uint32_t Begin[Callback::Size() + 1];
+    for (std::size_t K = 0; K + 1 < std::size(Counts); ++K)
+      Begin[K] = Counts[K];
+    for (std::uint32_t K = 0; K < Count; ++K)
+      sorted_[Counts[nodes_[batch_[K]].cb.typeId()]++] = batch_[K];
+
+    Alternatives::forEach([&] <typename T> () {
+      constexpr std::size_t Id = Callback::IdOf<T>();
+      const std::uint32_t End = (Id + 1 < std::size(Begin))
+        ? Begin[Id + 1] : Count;
+      for (std::uint32_t K = Begin[Id]; K < End; ++K)
+        nodes_[sorted_[K]].cb.getUnchecked<T>().fire(Ctx);
+    });
+    for (std::uint32_t K = 0; K < Count; ++K)
+      this->release(batch_[K]);
+  }
+
+private:
+  std::vector<Node> nodes_;
+  std::vector<std::uint32_t> batch_, sorted_;
+  std::uint32_t heads_[Levels * Slots];
+  std::uint32_t free_ = Nil;
+  std::uint64_t now_ = 0;
+};
+
+//=== Benchmark ===//
+
+static void bumpDeadline(Net& N, void*) { ++N.deadlines; }
+
+template <typename F>
+static void forOp(bench::Rng& R, std::uint32_t K, F&& Fn) {
+  switch (K & 3) {
+   case 0: Fn(CloseIdle{{}, K}); break;
+   case 1: Fn(Retransmit{{}, K, K * 7}); break;
+   case 2: Fn(KeepAlive{{}, K, R.next()}); break;
+   default: Fn(Deadline{{}, &bumpDeadline, nullptr}); break;
+  }
+}
+
+int main(int Argc, char** Argv) {
+  const std::uint32_t N = Argc > 1
+    ? std::uint32_t(std::strtoul(Argv[1], nullptr, 10)) : 1'000'000;
+  const std::uint64_t Horizon = 100'000;
+  const std::uint32_t Rounds = 4;
+
+  std::vector<std::uint64_t> Delays(N);
+  bench::Rng R;
+  for (auto& D : Delays)
+    D = 1 + R.below(std::uint32_t(Horizon));
+
+  // Wheel: schedule, cancel half (like acked retransmits), expire rest.
+  TimerWheel W {N};
+  std::vector<TimerWheel::Handle> Handles(N);
+  Net WNet;
+  std::size_t Allocs = 0;
+  double WSecs = 0;
+  for (std::uint32_t Round = 0; Round < Rounds; ++Round) {
+    const std::size_t Before = bench::allocs();
+    const auto T0 = bench::Clock::now();
+    for (std::uint32_t K = 0; K < N; ++K)
+      forOp(R, K, [&] (const auto& Cb) {
+        Handles[K] = W.schedule(Delays[K], Cb);
+      });
+    for (std::uint32_t K = 0; K < N; K += 2)
+      W.cancel(Handles[K]);
+    W.advance(W.now() + Horizon + 1, WNet);
+    WSecs += bench::secondsSince(T0);
+    if (Round != 0)
+      Allocs += bench::allocs() - Before;
+  }
+
+  // Baseline: ordered multimap keyed by expiry.
+  using Queue = std::multimap<std::uint64_t, std::function<void(Net&)>>;
+  Queue Q;
+  std::vector<Queue::iterator> Its(N);
+  Net MNet;
+  std::uint64_t Now = 0;
+  double MSecs = 0;
+  for (std::uint32_t Round = 0; Round < Rounds; ++Round) {
+    const auto T0 = bench::Clock::now();
+    for (std::uint32_t K = 0; K < N; ++K)
+      forOp(R, K, [&] (const auto& Cb) {
+        Its[K] = Q.emplace(Now + Delays[K], [Cb] (Net& C) { Cb.fire(C); });
+      });
+    for (std::uint32_t K = 0; K < N; K += 2)
+      Q.erase(Its[K]);
+    Now += Horizon + 1;
+    while (!Q.empty() && Q.begin()->first <= Now) {
+      Q.begin()->second(MNet);
+      Q.erase(Q.begin());
+    }
+    MSecs += bench::secondsSince(T0);
+  }
+
+  const double Ops = double(N) * Rounds * 2;
+  std::printf("timers: %u x %u rounds, half cancelled\n", N, Rounds);
+  std::printf("%-10s %7.2f M ops/s  steady-state allocations: %zu\n",
+    "wheel", Ops / WSecs / 1e6, Allocs);
+  std::printf("%-10s %7.2f M ops/s\n", "multimap", Ops / MSecs / 1e6);
+  if (WNet.closed != MNet.closed || WNet.resent != MNet.resent
+      || WNet.deadlines != MNet.deadlines) {
+    std::fprintf(stderr, "wheel and multimap fired different timers\n");
+    return 1;
+  }
+  if (Allocs != 0) {
+    std::fprintf(stderr, "steady state allocated %zu times\n", Allocs);
+    return 1;
+  }
+}
@@ -0,0 +1,331 @@
+//===- Actor.hpp ----------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements actors whose mailboxes are bounded MPSC rings
+//  of inline Poly messages, scheduled on a work-stealing pool. Each
+//  activation drains a batch and handles it grouped by alternative.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_ACTOR_HPP
+#define STANDALONE_POLY_ACTOR_HPP
+
+#include "Poly.hpp"
+#include <atomic>
+#include <bit>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace efl {
+  class ActorPool;
+
+  namespace H {
+    /// What the pool schedules. One virtual call per activation.
+    struct ActorBase {
+      virtual ~ActorBase() = default;
+      virtual void run() = 0;
+    };
+
+    /// Fixed-capacity Chase-Lev deque. The owner pushes and pops at the
+    /// bottom; thieves take from the top.
+    class WorkDeque {
+    public:
+      explicit WorkDeque(std::size_t Capacity)
+       : mask_(std::bit_ceil(Capacity) - 1),
+         slots_(new std::atomic<ActorBase*>[mask_ + 1]) {}
+
+      /// Owner only. Returns false when full.
+      bool push(ActorBase* A) {
+        const std::int64_t B = bottom_.load(std::memory_order_relaxed);
+        const std::int64_t T = top_.load(std::memory_order_acquire);
+        if (std::uint64_t(B - T) > mask_)
+          return false;
+        slots_[B & mask_].store(A, std::memory_order_relaxed);
+        bottom_.store(B + 1, std::memory_order_release);
+        return true;
+      }
+
+      /// Owner only.
+      ActorBase* pop() {
+        const std::int64_t B = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(B);
+        std::int64_t T = top_.load();
+        if (T > B) {
+          bottom_.store(B + 1, std::memory_order_relaxed);
+          return nullptr;
+        }
+        ActorBase* A = slots_[B & mask_].load(std::memory_order_relaxed);
+        if (T == B) {
+          if (!top_.compare_exchange_strong(T, T + 1))
+            A = nullptr;
+          bottom_.store(B + 1, std::memory_order_relaxed);
+        }
+        return A;
+      }
+
+      ActorBase* steal() {
+        std::int64_t T = top_.load();
+        const std::int64_t B = bottom_.load();
+        if (T >= B)
+          return nullptr;
+        ActorBase* A = slots_[T & mask_].load(std::memory_order_relaxed);
+        return top_.compare_exchange_strong(T, T + 1) ? A : nullptr;
+      }
+
+    private:
+      alignas(64) std::atomic<std::int64_t> top_ {0};
+      alignas(64) std::atomic<std::int64_t> bottom_ {0};
+      const std::size_t mask_;
+      std::unique_ptr<std::atomic<ActorBase*>[]> slots_;
+    };
+
+    inline thread_local ActorPool* CurrentPool = nullptr;
+    inline thread_local unsigned CurrentWorker = 0;
+  } // namespace H
+
+  /// Work-stealing pool. Workers run their own deque LIFO, then the
+  /// injection queue fed by outside threads, then steal.
+  class ActorPool {
+  public:
+    explicit ActorPool(
+        unsigned Threads = std::thread::hardware_concurrency(),
+        std::size_t DequeCapacity = 4096) {
+      Threads = Threads ? Threads : 1;
+      for (unsigned I = 0; I < Threads; ++I)
+        workers_.push_back(std::make_unique<Worker>(DequeCapacity));
+      for (unsigned I = 0; I < Threads; ++I)
+        workers_[I]->thread = std::thread([this, I] { this->work(I); });
+    }
+
+    ActorPool(const ActorPool&) = delete;
+    ActorPool& operator=(const ActorPool&) = delete;
+
+    /// Stops the workers. Actors still queued are not run.
+    ~ActorPool() {
+      stop_.store(true);
+      epoch_.fetch_add(1);
+      epoch_.notify_all();
+      for (auto& W : workers_)
+        W->thread.join();
+    }
+
+    void schedule(H::ActorBase* A) {
+      if (H::CurrentPool != this
+          || !workers_[H::CurrentWorker]->deque.push(A)) {
+        std::lock_guard G {injectLock_};
+        inject_.push_back(A);
+        injected_.fetch_add(1);
+      }
+      epoch_.fetch_add(1);
+      if (sleepers_.load() != 0)
+        epoch_.notify_one();
+    }
+
+    unsigned size() const noexcept { return unsigned(workers_.size()); }
+
+  private:
+    struct Worker {
+      explicit Worker(std::size_t Capacity) : deque(Capacity) {}
+      H::WorkDeque deque;
+      std::thread thread;
+    };
+
+    H::ActorBase* find(unsigned Index) {
+      if (H::ActorBase* A = workers_[Index]->deque.pop())
+        return A;
+      if (injected_.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard G {injectLock_};
+        if (!inject_.empty()) {
+          H::ActorBase* A = inject_.front();
+          inject_.pop_front();
+          injected_.fetch_sub(1);
+          return A;
+        }
+      }
+      for (std::size_t K = 1; K < workers_.size(); ++K) {
+        const std::size_t Victim = (Index + K) % workers_.size();
+        if (H::ActorBase* A = workers_[Victim]->deque.steal())
+          return A;
+      }
+      return nullptr;
+    }
+
+    void work(unsigned Index) {
+      H::CurrentPool = this;
+      H::CurrentWorker = Index;
+      unsigned Idle = 0;
+      while (!stop_.load(std::memory_order_relaxed)) {
+        if (H::ActorBase* A = this->find(Index)) {
+          A->run();
+          Idle = 0;
+          continue;
+        }
+        if (++Idle < 64) {
+          std::this_thread::yield();
+          continue;
+        }
+        // Re-check after announcing the sleep so a concurrent schedule
+        // either is seen here or bumps the epoch being waited on.
+        const std::uint32_t E = epoch_.load();
+        sleepers_.fetch_add(1);
+        if (H::ActorBase* A = this->find(Index)) {
+          sleepers_.fetch_sub(1);
+          A->run();
+          Idle = 0;
+          continue;
+        }
+        if (!stop_.load())
+          epoch_.wait(E);
+        sleepers_.fetch_sub(1);
+        Idle = 0;
+      }
+      H::CurrentPool = nullptr;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex injectLock_;
+    std::deque<H::ActorBase*> inject_;
+    std::atomic<std::size_t> injected_ {0};
+    std::atomic<std::uint32_t> epoch_ {0}, sleepers_ {0};
+    std::atomic<bool> stop_ {false};
+  };
+
+  /// An actor accepting `Msgs`, all derived from `Base`. `Derived`
+  /// provides `receive(T&)` for each message type. Messages of one type
+  /// are handled in send order; a batch is grouped by type, so order
+  /// across types within a batch is not preserved. Stop the pool before
+  /// destroying actors it may still run.
+  template <typename Derived, typename Base, std::derived_from<Base>...Msgs>
+  class Actor : private H::ActorBase {
+  public:
+    using Message = Poly<Base, Msgs...>;
+
+    explicit Actor(ActorPool& Pool, std::size_t Capacity = 1024,
+                   std::size_t Budget = 64)
+     : pool_(Pool), mask_(std::bit_ceil(Capacity) - 1),
+       budget_(std::min(Budget, mask_ + 1)),
+       slots_(std::make_unique<Slot[]>(mask_ + 1)),
+       order_(std::make_unique<std::uint32_t[]>(budget_)) {
+      for (std::size_t I = 0; I <= mask_; ++I)
+        slots_[I].seq.store(I, std::memory_order_relaxed);
+    }
+
+    Actor(const Actor&) = delete;
+    Actor& operator=(const Actor&) = delete;
+
+    /// Enqueues `M` from any thread and schedules the actor if idle.
+    /// Returns false if the mailbox is full.
+    template <typename T>
+    requires(H::matches_any<std::decay_t<T>, Msgs...>)
+    bool send(T&& M) {
+      std::uint64_t Pos = tail_.load(std::memory_order_relaxed);
+      Slot* S;
+      for (;;) {
+        S = &slots_[Pos & mask_];
+        const std::uint64_t Seq = S->seq.load(std::memory_order_acquire);
+        const auto Dif = std::int64_t(Seq - Pos);
+        if (Dif == 0) {
+          if (tail_.compare_exchange_weak(Pos, Pos + 1,
+              std::memory_order_relaxed))
+            break;
+        } else if (Dif < 0) {
+          return false;
+        } else {
+          Pos = tail_.load(std::memory_order_relaxed);
+        }
+      }
+      (void) S->message.template emplace<std::decay_t<T>>(
+        std::forward<T>(M));
+      S->seq.store(Pos + 1, std::memory_order_release);
+      if (!scheduled_.exchange(true, std::memory_order_acq_rel))
+        pool_.schedule(this);
+      return true;
+    }
+
+  private:
+    struct Slot {
+      std::atomic<std::uint64_t> seq;
+      Message message;
+    };
+
+    void run() final {
+      const std::uint64_t Head = head_;
+      std::size_t N = 0;
+      while (N < budget_ && slots_[(Head + N) & mask_].seq.load(
+          std::memory_order_acquire) == Head + N + 1)
+        ++N;
+      if (N != 0) {
+        this->dispatch(Head, N);
+        for (std::size_t K = 0; K < N; ++K) {
+          Slot& S = slots_[(Head + K) & mask_];
+          S.message.erase();
+          S.seq.store(Head + K + mask_ + 1, std::memory_order_release);
+        }
+        head_ = Head + N;
+      }
+      // Another activation may start once the flag drops, so only
+      // locals are touched after it.
+      const std::uint64_t Next = head_;
+      scheduled_.store(false);
+      if (slots_[Next & mask_].seq.load(std::memory_order_acquire)
+          == Next + 1 && !scheduled_.exchange(true))
+        pool_.schedule(this);
+    }
+
+    /// Counting-sorts the batch by alternative id, then hands each
+    /// group to `Derived::receive` as its concrete type.
+    void dispatch(std::uint64_t Head, std::size_t N) {
+      constexpr std::size_t Ids = Message::Size() + 1;
+      std::uint32_t Begin[Ids + 1] {};
+      for (std::size_t K = 0; K < N; ++K)
+        ++Begin[slots_[(Head + K) & mask_].message.typeId() + 1];
+      for (std::size_t I = 1; I <= Ids; ++I)
+        Begin[I] += Begin[I - 1];
+      std::uint32_t Fill[Ids];
+      std::copy(Begin, Begin + Ids, Fill);
+      for (std::size_t K = 0; K < N; ++K) {
+        const std::size_t Id = slots_[(Head + K) & mask_].message.typeId();
+        order_[Fill[Id]++] = std::uint32_t(K);
+      }
+
+      Derived& D = static_cast<Derived&>(*this);
+      ([&] {
+        constexpr std::size_t Id = Message::template IdOf<Msgs>();
+        for (std::uint32_t I = Begin[Id]; I < Begin[Id + 1]; ++I) {
+          Slot& S = slots_[(Head + order_[I]) & mask_];
+          D.receive(S.message.template getUnchecked<Msgs>());
+        }
+      }(), ...);
+    }
+
+    ActorPool& pool_;
+    const std::size_t mask_, budget_;
+    std::unique_ptr<Slot[]> slots_;
+    std::unique_ptr<std::uint32_t[]> order_;
+    alignas(64) std::atomic<std::uint64_t> tail_ {0};
+    alignas(64) std::uint64_t head_ = 0;
+    std::atomic<bool> scheduled_ {false};
+  };
+} // namespace efl
+
+#endif // STANDALONE_POLY_ACTOR_HPP
@@ -0,0 +1,274 @@
+//===- CommandBuffer.hpp --------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements a command recorder over a closed set of types.
+//  Commands are packed back to back at their own sizes, sorted by a
+//  64-bit key through an index array, and executed by compact id.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_COMMANDBUFFER_HPP
+#define STANDALONE_POLY_COMMANDBUFFER_HPP
+
+#include "Poly.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GNUC__)
+# define POLY_PREFETCH(...) __builtin_prefetch(__VA_ARGS__)
+#else
+# define POLY_PREFETCH(...) (void)0
+#endif
+
+namespace efl {
+  template <typename Base, std::derived_from<Base>...Cmds>
+  struct CommandBuffer {
+    static_assert(sizeof...(Cmds) > 0 && sizeof...(Cmds) < 0xFFFF);
+  private:
+    struct Header {
+      std::uint64_t key;
+      std::uint32_t size;
+      std::uint16_t id;
+    };
+
+    static constexpr std::size_t Align = std::max({
+      alignof(Header), alignof(Cmds)...});
+    static_assert(Align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+      "Over-aligned commands are not supported!");
+
+    static constexpr std::size_t HeaderSize
+      = (sizeof(Header) + Align - 1) & ~(Align - 1);
+
+    static constexpr bool Trivial
+      = H::all_trivially_relocatable<Cmds...>;
+
+    template <typename T>
+    static constexpr std::uint16_t IdOf = [] {
+      std::uint16_t I = 0, Out = 0;
+      ((std::same_as<T, Cmds> ? (Out = I) : 0, ++I), ...);
+      return Out;
+    }();
+
+    template <typename T>
+    static constexpr std::uint32_t RecordSize = std::uint32_t(
+      (HeaderSize + sizeof(T) + Align - 1) & ~(Align - 1));
+
+  public:
+    CommandBuffer() = default;
+    CommandBuffer(const CommandBuffer&) = delete;
+    CommandBuffer(CommandBuffer&& O) noexcept
+     : bytes_(std::move(O.bytes_)), order_(std::move(O.order_)) {
+      O.clear();
+    }
+    ~CommandBuffer() { this->clear(); }
+
+    //=== Recording ===//
+
+    /// Constructs a `T` at the end of the buffer, ordered by `Key`.
+    template <typename T, typename...Args>
+    requires(H::matches_any<T, Cmds...>
+      && std::constructible_from<T, Args...>)
+    T& record(std::uint64_t Key, Args&&...args) {
+      constexpr std::uint32_t Size = RecordSize<T>;
+      const std::size_t Off = bytes_.size();
+      this->grow(Off + Size);
+      const Header Hdr {Key, Size, IdOf<T>};
+      std::memcpy(bytes_.data() + Off, &Hdr, sizeof(Hdr));
+      T* P = new (bytes_.data() + Off + HeaderSize)
+        T(std::forward<Args>(args)...);
+      order_.push_back(std::uint32_t(Off));
+      return *P;
+    }
+
+    /// Moves every command out of `O`, appending in `O`'s order.
+    void append(CommandBuffer& O) {
+      const std::size_t Start = bytes_.size();
+      this->grow(Start + O.bytes_.size());
+      for (std::uint32_t Off : O.order_) {
+        const std::size_t To = Start + Off;
+        if constexpr (Trivial) {
+          (void) To;
+        } else {
+          std::memcpy(bytes_.data() + To, O.bytes_.data() + Off, HeaderSize);
+          O.relocateOne(O.bytes_.data() + Off, bytes_.data() + To);
+        }
+        order_.push_back(std::uint32_t(To));
+      }
+      if constexpr (Trivial) {
+        std::memcpy(bytes_.data() + Start,
+          O.bytes_.data(), O.bytes_.size());
+      }
+      O.bytes_.clear();
+      O.order_.clear();
+    }
+
+    /// Merges per-thread buffers into this one.
+    void submit(std::span<CommandBuffer> Recorded) {
+      std::size_t Total = bytes_.size();
+      for (auto& B : Recorded)
+        Total += B.bytes_.size();
+      this->reserve(Total);
+      for (auto& B : Recorded)
+        this->append(B);
+    }
+
+    /// Stable LSD radix sort of the execution order by key. Byte
+    /// positions where every key agrees are skipped.
+    void sort() {
+      const std::size_t N = order_.size();
+      keys_.resize(N);
+      tmpKeys_.resize(N);
+      tmpOrder_.resize(N);
+      std::uint64_t Or = 0, And = ~std::uint64_t(0);
+      for (std::size_t I = 0; I < N; ++I) {
+        keys_[I] = this->header(order_[I]).key;
+        Or |= keys_[I];
+        And &= keys_[I];
+      }
+      const std::uint64_t Varying = Or ^ And;
+      for (unsigned Shift = 0; Shift < 64; Shift += 8) {
+        if (((Varying >> Shift) & 0xFF) == 0)
+          continue;
+        std::size_t Count[257] {};
+        for (std::size_t I = 0; I < N; ++I)
+          ++Count[((keys_[I] >> Shift) & 0xFF) + 1];
+        for (std::size_t B = 1; B < 257; ++B)
+          Count[B] += Count[B - 1];
+        for (std::size_t I = 0; I < N; ++I) {
+          const std::size_t D = Count[(keys_[I] >> Shift) & 0xFF]++;
+          tmpKeys_[D] = keys_[I];
+          tmpOrder_[D] = order_[I];
+        }
+        keys_.swap(tmpKeys_);
+        order_.swap(tmpOrder_);
+      }
+    }
+
+    //=== Execution ===//
+
+    /// Invokes `F` with each command as its concrete type, in order.
+    /// Records `Ahead` positions forward are prefetched.
+    template <std::size_t Ahead = 4, typename F>
+    void execute(F&& Fn) {
+      using Thunk = void(*)(std::uint8_t*, F&);
+      static constexpr Thunk Table[] {
+        [] (std::uint8_t* P, F& G) {
+          (void) G(*H::launder_cast<Cmds>(P));
+        }...
+      };
+      const std::size_t N = order_.size();
+      std::uint8_t* Data = bytes_.data();
+      for (std::size_t I = 0; I < N; ++I) {
+        if (I + Ahead < N)
+          POLY_PREFETCH(Data + order_[I + Ahead]);
+        std::uint8_t* R = Data + order_[I];
+        Table[this->header(order_[I]).id](R + HeaderSize, Fn);
+      }
+    }
+
+    void clear() noexcept {
+      if constexpr (!std::conjunction_v<
+          std::is_trivially_destructible<Cmds>...>) {
+        for (std::uint32_t Off : order_)
+          this->destroyOne(bytes_.data() + Off);
+      }
+      bytes_.clear();
+      order_.clear();
+    }
+
+    //=== Observers ===//
+
+    std::size_t size() const noexcept { return order_.size(); }
+    bool empty() const noexcept { return order_.empty(); }
+    std::size_t bytes() const noexcept { return bytes_.size(); }
+
+  private:
+    Header header(std::uint32_t Off) const noexcept {
+      Header Hdr;
+      std::memcpy(&Hdr, bytes_.data() + Off, sizeof(Hdr));
+      return Hdr;
+    }
+
+    template <typename F>
+    void dispatch(std::uint8_t* Record, F&& Fn) {
+      const std::uint16_t Id = this->header(
+        std::uint32_t(Record - bytes_.data())).id;
+      std::uint16_t I = 0;
+      (void) ((Id == I++
+        ? (Fn(H::launder_cast<Cmds>(Record + HeaderSize)), true)
+        : false) || ...);
+    }
+
+    void destroyOne(std::uint8_t* Record) {
+      this->dispatch(Record, [] <typename T> (T* P) { P->~T(); });
+    }
+
+    void relocateOne(std::uint8_t* From, std::uint8_t* To) {
+      this->dispatch(From, [To] <typename T> (T* P) {
+        (void) new (To + HeaderSize) T(std::move(*P));
+        P->~T();
+      });
+    }
+
+    /// Makes room for `N` bytes without changing the size, moving
+    /// commands if storage is reallocated. Offsets are 32 bits, so the
+    /// buffer is limited to 4 GiB.
+    void reserve(std::size_t N) {
+      if (N > std::numeric_limits<std::uint32_t>::max())
+        throw std::length_error("CommandBuffer exceeds 4 GiB");
+      if (N <= bytes_.capacity())
+        return;
+      const std::size_t Cap = std::max(N, bytes_.capacity() * 2);
+      if constexpr (Trivial) {
+        bytes_.reserve(Cap);
+      } else {
+        std::vector<std::uint8_t> New;
+        New.reserve(Cap);
+        New.resize(bytes_.size());
+        for (std::uint32_t Off : order_) {
+          std::memcpy(New.data() + Off, bytes_.data() + Off, HeaderSize);
+          this->relocateOne(bytes_.data() + Off, New.data() + Off);
+        }
+        bytes_.swap(New);
+      }
+    }
+
+    /// Grows to `N` bytes.
+    void grow(std::size_t N) {
+      this->reserve(N);
+      bytes_.resize(N);
+    }
+
+  private:
+    std::vector<std::uint8_t> bytes_;
+    std::vector<std::uint32_t> order_;
+    std::vector<std::uint64_t> keys_, tmpKeys_;
+    std::vector<std::uint32_t> tmpOrder_;
+  };
+} // namespace efl
+
+#undef POLY_PREFETCH
+
+#endif // STANDALONE_POLY_COMMANDBUFFER_HPP
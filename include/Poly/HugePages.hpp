@@ -0,0 +1,226 @@
+//===- HugePages.hpp ------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements huge-page backed storage for large Poly
+//  containers: a mapped region and an allocator for standard
+//  containers. Mapping tries MAP_HUGETLB, then transparent huge pages,
+//  then plain pages, and can pre-fault everything up front.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_HUGEPAGES_HPP
+#define STANDALONE_POLY_HUGEPAGES_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if __has_include(<sys/mman.h>)
+# include <sys/mman.h>
+# define POLY_HUGEPAGES_MMAP 1
+#endif
+
+namespace efl {
+  /// What a mapping ended up backed by. `Transparent` means the kernel
+  /// accepted the advice, not that every page was promoted.
+  enum class PageBacking : std::uint8_t { Small, Transparent, Explicit };
+
+  struct HugePageOptions {
+    /// Try MAP_HUGETLB first. Needs pages reserved in vm.nr_hugepages.
+    bool explicitPages = true;
+    /// Otherwise advise MADV_HUGEPAGE on a huge-page aligned mapping.
+    bool transparent = true;
+    /// Fault every page in when mapping instead of on first touch.
+    bool populate = false;
+  };
+
+  inline constexpr std::size_t HugePageSize = std::size_t(2) << 20;
+
+  namespace H {
+    struct HugeMapping {
+      void* data;
+      PageBacking backing;
+    };
+
+    inline constexpr std::size_t roundHuge(std::size_t N) noexcept {
+      return (N + HugePageSize - 1) & ~(HugePageSize - 1);
+    }
+
+    /// Writes one byte per small page so each one is faulted in.
+    inline void prefault(void* P, std::size_t Size) noexcept {
+#if defined(POLY_HUGEPAGES_MMAP) && defined(MADV_POPULATE_WRITE)
+      if (::madvise(P, Size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+      auto* Bytes = static_cast<volatile char*>(P);
+      for (std::size_t I = 0; I < Size; I += 4096)
+        Bytes[I] = 0;
+    }
+
+    /// Maps at least `Bytes`, rounded up to whole huge pages. Throws
+    /// `std::bad_alloc` only if every fallback fails.
+    inline HugeMapping mapHuge(std::size_t Bytes, HugePageOptions Opts) {
+      const std::size_t Size = roundHuge(Bytes ? Bytes : 1);
+#ifdef POLY_HUGEPAGES_MMAP
+      constexpr int Prot = PROT_READ | PROT_WRITE;
+      const int Populate = Opts.populate ? MAP_POPULATE : 0;
+# ifdef MAP_HUGETLB
+      if (Opts.explicitPages) {
+        void* P = ::mmap(nullptr, Size, Prot,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | Populate, -1, 0);
+        if (P != MAP_FAILED)
+          return {P, PageBacking::Explicit};
+      }
+# endif
+      // Transparent pages are only used for aligned 2M ranges, so map
+      // one extra huge page and trim. MAP_POPULATE would fault small
+      // pages before the advice lands; populate afterwards instead.
+      const int Flags = MAP_PRIVATE | MAP_ANONYMOUS
+        | (Opts.transparent ? 0 : Populate);
+      void* Raw = ::mmap(nullptr, Size + HugePageSize, Prot, Flags, -1, 0);
+      if (Raw == MAP_FAILED)
+        throw std::bad_alloc();
+      auto* Begin = static_cast<char*>(Raw);
+      auto* P = reinterpret_cast<char*>(
+        roundHuge(reinterpret_cast<std::uintptr_t>(Begin)));
+      if (P != Begin)
+        ::munmap(Begin, std::size_t(P - Begin));
+      if (char* End = Begin + Size + HugePageSize; P + Size != End)
+        ::munmap(P + Size, std::size_t(End - (P + Size)));
+
+      PageBacking Backing = PageBacking::Small;
+# ifdef MADV_HUGEPAGE
+      if (Opts.transparent && ::madvise(P, Size, MADV_HUGEPAGE) == 0)
+        Backing = PageBacking::Transparent;
+# endif
+      if (Opts.transparent && Opts.populate)
+        prefault(P, Size);
+      return {P, Backing};
+#else
+      void* P = ::operator new(Size, std::align_val_t(HugePageSize));
+      if (Opts.populate)
+        prefault(P, Size);
+      return {P, PageBacking::Small};
+#endif
+    }
+
+    inline void unmapHuge(void* P, std::size_t Bytes) noexcept {
+#ifdef POLY_HUGEPAGES_MMAP
+      ::munmap(P, roundHuge(Bytes ? Bytes : 1));
+#else
+      (void) Bytes;
+      ::operator delete(P, std::align_val_t(HugePageSize));
+#endif
+    }
+  } // namespace H
+
+  /// An anonymous mapping of whole huge pages, released on destruction.
+  class HugeRegion {
+  public:
+    HugeRegion() = default;
+
+    explicit HugeRegion(std::size_t Bytes, HugePageOptions Opts = {})
+     : size_(H::roundHuge(Bytes ? Bytes : 1)) {
+      const H::HugeMapping M = H::mapHuge(Bytes, Opts);
+      data_ = M.data;
+      backing_ = M.backing;
+    }
+
+    HugeRegion(HugeRegion&& R) noexcept
+     : data_(std::exchange(R.data_, nullptr)),
+       size_(std::exchange(R.size_, 0)), backing_(R.backing_) {}
+
+    HugeRegion& operator=(HugeRegion&& R) noexcept {
+      HugeRegion(std::move(R)).swap(*this);
+      return *this;
+    }
+
+    ~HugeRegion() {
+      if (data_)
+        H::unmapHuge(data_, size_);
+    }
+
+    void swap(HugeRegion& R) noexcept {
+      std::swap(data_, R.data_);
+      std::swap(size_, R.size_);
+      std::swap(backing_, R.backing_);
+    }
+
+    void* data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    PageBacking backing() const noexcept { return backing_; }
+
+  private:
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+    PageBacking backing_ = PageBacking::Small;
+  };
+
+  /// Allocator for containers of Poly values. Allocations of at least
+  /// half a huge page get their own mapping; smaller ones use the
+  /// global heap, where huge pages would mostly be wasted.
+  template <typename T>
+  class HugePageAllocator {
+    template <typename> friend class HugePageAllocator;
+  public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    HugePageAllocator() noexcept = default;
+    explicit HugePageAllocator(HugePageOptions Opts) noexcept
+     : opts_(Opts) {}
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>& A) noexcept
+     : opts_(A.opts_) {}
+
+    T* allocate(std::size_t N) {
+      const std::size_t Bytes = N * sizeof(T);
+      if (Bytes < HugePageSize / 2)
+        return static_cast<T*>(
+          ::operator new(Bytes, std::align_val_t(alignof(T))));
+      return static_cast<T*>(H::mapHuge(Bytes, opts_).data);
+    }
+
+    void deallocate(T* P, std::size_t N) noexcept {
+      const std::size_t Bytes = N * sizeof(T);
+      if (Bytes < HugePageSize / 2)
+        ::operator delete(P, std::align_val_t(alignof(T)));
+      else
+        H::unmapHuge(P, Bytes);
+    }
+
+    HugePageOptions options() const noexcept { return opts_; }
+
+    /// Any instance can release any allocation; options only affect
+    /// how new storage is mapped.
+    template <typename U>
+    bool operator==(const HugePageAllocator<U>&) const noexcept {
+      return true;
+    }
+
+  private:
+    HugePageOptions opts_;
+  };
+} // namespace efl
+
+#endif // STANDALONE_POLY_HUGEPAGES_HPP
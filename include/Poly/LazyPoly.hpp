@@ -0,0 +1,243 @@
+//===- LazyPoly.hpp -------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements Poly objects whose alternative is constructed
+//  on first access. Until then the Poly storage holds the constructor
+//  arguments. A manager pointer and a state byte sit beside it, so a
+//  LazyPoly is one pointer and one word larger than the Poly.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_LAZYPOLY_HPP
+#define STANDALONE_POLY_LAZYPOLY_HPP
+
+#include "Poly.hpp"
+#include <atomic>
+#include <tuple>
+#include <type_traits>
+
+namespace efl::H {
+  template <bool Sync, typename Base, typename...Derived>
+  struct LazyPolyImpl {
+    using PolyType = Poly<Base, Derived...>;
+  private:
+    enum class Op : std::uint8_t { Materialize, Copy, Move, Destroy };
+    using ManageFn = void(*)(Op, void* Dst, void* Src);
+
+    enum State : std::uint8_t { Ready, Pending, Busy };
+    using StateType = std::conditional_t<Sync,
+      std::atomic<std::uint8_t>, std::uint8_t>;
+
+  public:
+    LazyPolyImpl() noexcept { (void) new (storage_) PolyType(); }
+
+    LazyPolyImpl(const PolyType& P) { (void) new (storage_) PolyType(P); }
+
+    LazyPolyImpl(PolyType&& P) noexcept {
+      (void) new (storage_) PolyType(std::move(P));
+    }
+
+    /// Records the arguments for a `U`, constructed on first access.
+    template <typename U, typename...Args>
+    explicit LazyPolyImpl(std::in_place_type_t<U>, Args&&...args) {
+      this->deferImpl<U>(std::forward<Args>(args)...);
+    }
+
+    LazyPolyImpl(const LazyPolyImpl& L) requires(!Sync)
+     : manage_(L.manage_), state_(L.state_) {
+      if (state_ == Pending)
+        manage_(Op::Copy, storage_, L.storage_);
+      else
+        (void) new (storage_) PolyType(L.poly());
+    }
+
+    LazyPolyImpl(LazyPolyImpl&& L) noexcept requires(!Sync)
+     : manage_(L.manage_), state_(L.state_) {
+      if (state_ == Pending)
+        manage_(Op::Move, storage_, L.storage_);
+      else
+        (void) new (storage_) PolyType(std::move(L.poly()));
+    }
+
+    ~LazyPolyImpl() { this->destroy(); }
+
+    /// Discards the current state and defers construction of a `U`.
+    /// If copying the arguments throws, this is left empty. This is not
+    /// synchronized, even in the thread-safe variant.
+    template <typename U, typename...Args>
+    void defer(Args&&...args) {
+      this->destroy();
+      (void) new (storage_) PolyType();
+      this->setState(Ready);
+      this->deferImpl<U>(std::forward<Args>(args)...);
+    }
+
+    //=== Accessors ===//
+
+    PolyType& operator*() { return materialize(); }
+    const PolyType& operator*() const { return materialize(); }
+
+    Base* operator->() { return materialize().operator->(); }
+    const Base* operator->() const {
+      return materialize().operator->();
+    }
+
+    void visit(auto&& F) {
+      materialize().visit(std::forward<decltype(F)>(F));
+    }
+
+    void visit(auto&& F) const {
+      materialize().visit(std::forward<decltype(F)>(F));
+    }
+
+    /// Constructs the deferred alternative, if any. In the thread-safe
+    /// variant, exactly one caller constructs and the rest wait.
+    PolyType& materialize() const {
+      if constexpr (Sync) {
+        if (state_.load(std::memory_order_acquire) != Ready)
+          [[unlikely]] this->materializeSync();
+      } else {
+        if (state_ != Ready) [[unlikely]]
+          this->materializeNow();
+      }
+      return poly();
+    }
+
+    //=== Observers ===//
+
+    bool isMaterialized() const noexcept {
+      if constexpr (Sync)
+        return state_.load(std::memory_order_acquire) == Ready;
+      else
+        return state_ == Ready;
+    }
+
+  private:
+    template <typename U, typename Tuple>
+    static void Manage(Op O, void* Dst, void* Src) {
+      switch (O) {
+       case Op::Materialize: {
+        // Whatever throws, `Dst` must hold a valid (empty) Poly when
+        // this returns, since the caller marks the object Ready.
+        Tuple* Args = H::launder_cast<Tuple>(Src);
+        Tuple Local = [Args, Dst] {
+          try {
+            return Tuple(std::move(*Args));
+          } catch (...) {
+            Args->~Tuple();
+            (void) new (Dst) PolyType();
+            throw;
+          }
+        }();
+        Args->~Tuple();
+        auto* P = new (Dst) PolyType();
+        std::apply([P] (auto&...A) {
+          (void) P->template emplace<U>(std::move(A)...);
+        }, Local);
+        break;
+       }
+       case Op::Copy:
+        (void) new (Dst) Tuple(*H::launder_cast<Tuple>(Src));
+        break;
+       case Op::Move:
+        (void) new (Dst) Tuple(
+          std::move(*H::launder_cast<Tuple>(Src)));
+        break;
+       case Op::Destroy:
+        H::launder_cast<Tuple>(Src)->~Tuple();
+        break;
+      }
+    }
+
+    template <typename U, typename...Args>
+    void deferImpl(Args&&...args) {
+      using Tuple = std::tuple<std::decay_t<Args>...>;
+      static_assert(sizeof(Tuple) <= sizeof(PolyType)
+        && alignof(Tuple) <= alignof(PolyType),
+        "Deferred arguments must fit in the Poly storage!");
+      static_assert(std::is_constructible_v<U, std::decay_t<Args>&&...>);
+      (void) new (storage_) Tuple(std::forward<Args>(args)...);
+      this->manage_ = &Manage<U, Tuple>;
+      this->setState(Pending);
+    }
+
+    void materializeNow() const {
+      // If construction throws, the Poly is left empty but valid and
+      // any waiters are still released.
+      struct Guard {
+        ~Guard() {
+          self->setState(Ready);
+          if constexpr (Sync)
+            self->state_.notify_all();
+        }
+        const LazyPolyImpl* self;
+      } G {this};
+      manage_(Op::Materialize, storage_, storage_);
+    }
+
+    void materializeSync() const requires Sync {
+      std::uint8_t S = Pending;
+      if (state_.compare_exchange_strong(S, Busy,
+          std::memory_order_acquire)) {
+        this->materializeNow();
+        return;
+      }
+      while (S != Ready) {
+        state_.wait(S, std::memory_order_acquire);
+        S = state_.load(std::memory_order_acquire);
+      }
+    }
+
+    void destroy() noexcept {
+      if (this->isMaterialized())
+        poly().~PolyType();
+      else
+        manage_(Op::Destroy, nullptr, storage_);
+    }
+
+    void setState(State S) const noexcept {
+      if constexpr (Sync)
+        state_.store(S, std::memory_order_release);
+      else
+        state_ = S;
+    }
+
+    PolyType& poly() const noexcept {
+      return *H::launder_cast<PolyType>(storage_);
+    }
+
+  private:
+    alignas(PolyType) mutable std::uint8_t storage_[sizeof(PolyType)];
+    ManageFn manage_ = nullptr;
+    mutable StateType state_ {Ready};
+  };
+} // namespace efl::H
+
+namespace efl {
+  /// A `Poly` which constructs its alternative on first access.
+  template <typename Base, std::derived_from<Base>...Derived>
+  using LazyPoly = H::LazyPolyImpl<false, Base, Derived...>;
+
+  /// A `LazyPoly` which may be materialized from multiple threads.
+  template <typename Base, std::derived_from<Base>...Derived>
+  using SyncLazyPoly = H::LazyPolyImpl<true, Base, Derived...>;
+} // namespace efl
+
+#endif // STANDALONE_POLY_LAZYPOLY_HPP
@@ -0,0 +1,268 @@
+//===- Parallel.hpp -------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements bulk copy, fill and destruction of Poly arrays
+//  on a fork-join pool. Work is split into fixed chunks; each chunk is
+//  grouped by alternative so per-type loops run without dispatch, and
+//  alternatives with trivial operations are skipped or copied bytewise.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_PARALLEL_HPP
+#define STANDALONE_POLY_PARALLEL_HPP
+
+#include "Poly.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <ranges>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace efl {
+  /// Fork-join pool. The calling thread takes part in every job.
+  class TaskPool {
+  public:
+    explicit TaskPool(
+        unsigned Threads = std::thread::hardware_concurrency()) {
+      for (unsigned I = 1; I < Threads; ++I)
+        workers_.emplace_back([this] { this->work(); });
+    }
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    ~TaskPool() {
+      {
+        std::lock_guard G {lock_};
+        stop_ = true;
+      }
+      wake_.notify_all();
+      for (auto& W : workers_)
+        W.join();
+    }
+
+    /// Calls `Fn(I)` for every `I < N` and returns once all are done.
+    /// `Fn` must not throw.
+    template <typename F>
+    void forEach(std::size_t N, F&& Fn) {
+      if (workers_.empty() || N <= 1) {
+        for (std::size_t I = 0; I < N; ++I)
+          Fn(I);
+        return;
+      }
+      {
+        std::lock_guard G {lock_};
+        call_ = [] (void* Ctx, std::size_t I) {
+          (*static_cast<std::remove_reference_t<F>*>(Ctx))(I);
+        };
+        ctx_ = &Fn;
+        count_ = N;
+        next_.store(0, std::memory_order_relaxed);
+        active_ = workers_.size();
+        ++generation_;
+      }
+      wake_.notify_all();
+      this->drain();
+      std::unique_lock G {lock_};
+      done_.wait(G, [this] { return active_ == 0; });
+    }
+
+    unsigned size() const noexcept { return unsigned(workers_.size() + 1); }
+
+  private:
+    void drain() {
+      for (std::size_t I; (I = next_.fetch_add(1)) < count_;)
+        call_(ctx_, I);
+    }
+
+    void work() {
+      std::uint64_t Seen = 0;
+      std::unique_lock G {lock_};
+      for (;;) {
+        wake_.wait(G, [&] { return stop_ || generation_ != Seen; });
+        if (stop_)
+          return;
+        Seen = generation_;
+        G.unlock();
+        this->drain();
+        G.lock();
+        if (--active_ == 0)
+          done_.notify_one();
+      }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex lock_;
+    std::condition_variable wake_, done_;
+    void (*call_)(void*, std::size_t) = nullptr;
+    void* ctx_ = nullptr;
+    std::size_t count_ = 0, active_ = 0;
+    std::atomic<std::size_t> next_ {0};
+    std::uint64_t generation_ = 0;
+    bool stop_ = false;
+  };
+} // namespace efl
+
+namespace efl::H {
+  inline constexpr std::size_t ParallelGrain = 4096;
+
+  inline constexpr std::size_t chunksOf(std::size_t N) noexcept {
+    return (N + ParallelGrain - 1) / ParallelGrain;
+  }
+
+  /// Calls `F.template operator()<T>()` for each alternative a
+  /// `Poly<Base, Derived...>` can hold.
+  template <typename Base, typename...Derived>
+  void forEachAlternative(auto&& F) {
+    if constexpr (is_concrete<Base>)
+      F.template operator()<Base>();
+    (F.template operator()<Derived>(), ...);
+  }
+
+  /// The indices of one chunk, counting-sorted by `typeId()`.
+  template <typename P>
+  struct TypeGroups {
+    static constexpr std::size_t Ids = P::Size() + 1;
+
+    explicit TypeGroups(const P* Data, std::size_t N) {
+      std::fill_n(begin, Ids + 1, 0u);
+      for (std::size_t I = 0; I < N; ++I)
+        ++begin[Data[I].typeId() + 1];
+      for (std::size_t I = 1; I <= Ids; ++I)
+        begin[I] += begin[I - 1];
+      std::uint32_t Fill[Ids];
+      std::copy(begin, begin + Ids, Fill);
+      for (std::size_t I = 0; I < N; ++I)
+        order[Fill[Data[I].typeId()]++] = std::uint32_t(I);
+    }
+
+    std::span<const std::uint32_t> of(std::size_t Id) const {
+      return {order + begin[Id], order + begin[Id + 1]};
+    }
+
+    std::uint32_t begin[Ids + 1];
+    std::uint32_t order[ParallelGrain];
+  };
+
+  template <typename Base, typename...Derived>
+  void destroyChunks(TaskPool& Pool, Poly<Base, Derived...>* Data,
+                     std::size_t N) {
+    using P = Poly<Base, Derived...>;
+    if constexpr (!all_trivially_destructible<Base, Derived...>) {
+      Pool.forEach(chunksOf(N), [Data, N] (std::size_t C) {
+        const std::size_t Off = C * ParallelGrain;
+        P* Chunk = Data + Off;
+        const TypeGroups<P> G(Chunk, std::min(ParallelGrain, N - Off));
+        forEachAlternative<Base, Derived...>([&] <typename T> {
+          if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (std::uint32_t I : G.of(P::template IdOf<T>()))
+              PolyAccess::destroyAs<T>(Chunk[I]);
+          }
+        });
+      });
+    }
+  }
+
+  template <typename Base, typename...Derived>
+  void copyChunks(TaskPool& Pool, const Poly<Base, Derived...>* Src,
+                  std::size_t N, Poly<Base, Derived...>* Dst) {
+    using P = Poly<Base, Derived...>;
+    Pool.forEach(chunksOf(N), [Src, N, Dst] (std::size_t C) {
+      const std::size_t Off = C * ParallelGrain;
+      const std::size_t Count = std::min(ParallelGrain, N - Off);
+      const P* From = Src + Off;
+      P* To = Dst + Off;
+      if constexpr (all_trivially_relocatable<Base, Derived...>) {
+        std::memcpy(static_cast<void*>(To), From, Count * sizeof(P));
+      } else {
+        const TypeGroups<P> G(From, Count);
+        for (std::uint32_t I : G.of(0))
+          (void) new (To + I) P();
+        forEachAlternative<Base, Derived...>([&] <typename T> {
+          for (std::uint32_t I : G.of(P::template IdOf<T>()))
+            (void) new (To + I) P(From[I].template getUnchecked<T>());
+        });
+      }
+    });
+  }
+} // namespace efl::H
+
+namespace efl::par {
+  /// Destroys the objects held by `Range`, any contiguous range of
+  /// `Poly` such as a `std::vector` or `std::span`. Each chunk calls the
+  /// destructor of one alternative at a time without dispatch. Elements
+  /// holding trivially destructible alternatives are not touched, so
+  /// afterwards every element is either empty or holds something whose
+  /// destruction is a no-op. If every alternative is trivial this does
+  /// nothing.
+  template <std::ranges::contiguous_range R>
+  requires H::is_poly<std::ranges::range_value_t<R>>
+  void destroy(TaskPool& Pool, R&& Range) {
+    H::destroyChunks(Pool, std::ranges::data(Range),
+      std::size_t(std::ranges::size(Range)));
+  }
+
+  /// Copy-constructs `Src`, any contiguous range of `Poly`, into the
+  /// uninitialized storage at `Dst`. Trivially copyable sets are copied
+  /// bytewise; otherwise each chunk is copied one alternative at a time.
+  /// Copies must not throw.
+  template <std::ranges::contiguous_range R>
+  requires H::is_poly<std::ranges::range_value_t<R>>
+  void uninitializedCopy(TaskPool& Pool, R&& Src,
+                         std::ranges::range_value_t<R>* Dst) {
+    H::copyChunks(Pool, std::ranges::data(Src),
+      std::size_t(std::ranges::size(Src)), Dst);
+  }
+
+  /// Constructs `N` elements at `Dst`, each holding a `U` built from
+  /// `Args` as `emplace` would. A trivially copyable `U` is built once
+  /// and replicated bytewise.
+  template <typename U, typename Base, typename...Derived,
+            typename...Args>
+  requires(H::matches_any<U, Base, Derived...> && H::is_concrete<U>
+    && std::constructible_from<U, const Args&...>)
+  void fillEmplace(TaskPool& Pool, Poly<Base, Derived...>* Dst,
+                   std::size_t N, const Args&...args) {
+    using P = Poly<Base, Derived...>;
+    if constexpr (std::is_trivially_copyable_v<U>) {
+      P Proto;
+      (void) Proto.template emplace<U>(args...);
+      Pool.forEach(H::chunksOf(N), [&Proto, Dst, N] (std::size_t C) {
+        const std::size_t Off = C * H::ParallelGrain;
+        const std::size_t E = std::min(Off + H::ParallelGrain, N);
+        for (std::size_t I = Off; I < E; ++I)
+          std::memcpy(static_cast<void*>(Dst + I), &Proto, sizeof(P));
+      });
+    } else {
+      Pool.forEach(H::chunksOf(N), [&, Dst, N] (std::size_t C) {
+        const std::size_t Off = C * H::ParallelGrain;
+        const std::size_t E = std::min(Off + H::ParallelGrain, N);
+        for (std::size_t I = Off; I < E; ++I)
+          (void) (new (Dst + I) P())->template emplace<U>(args...);
+      });
+    }
+  }
+} // namespace efl::par
+
+#endif // STANDALONE_POLY_PARALLEL_HPP
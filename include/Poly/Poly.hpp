@@ -64,6 +64,21 @@
 # define POLY_ASSERT(...) assert(__VA_ARGS__)
 #endif
 
+#ifndef POLY_ASSUME
+# if __has_cpp_attribute(assume) >= 202207L
+#  define POLY_ASSUME(...) [[assume(__VA_ARGS__)]]
+# elif defined(__clang__)
+#  define POLY_ASSUME(...) __builtin_assume(__VA_ARGS__)
+# elif defined(_MSC_VER)
+#  define POLY_ASSUME(...) __assume(__VA_ARGS__)
+# elif defined(__GNUC__)
+#  define POLY_ASSUME(...) \
+  do { if (!(__VA_ARGS__)) __builtin_unreachable(); } while (0)
+# else
+#  define POLY_ASSUME(...) (void)0
+# endif
+#endif
+
 #ifndef POLY_FWD
 # define POLY_FWD(...) static_cast< \
   decltype(__VA_ARGS__)&&>(__VA_ARGS__)
@@ -76,6 +91,8 @@ namespace efl {
 } // namespace efl
 
 namespace efl::H {
+  struct PolyAccess;
+
   template <typename T, typename...TT>
   union RecursiveUnion {
     constexpr ~RecursiveUnion() {}
@@ -170,6 +187,18 @@ namespace efl::H {
   template <typename...TT>
   concept all_movable = (true && ... && movable<TT>);
 
+  template <typename T>
+  concept trivially_relocatable = std::is_trivially_copyable_v<T>;
+
+  template <typename...TT>
+  concept all_trivially_relocatable
+    = (true && ... && trivially_relocatable<TT>);
+
+  template <typename Base, typename...Derived>
+  concept all_trivially_destructible = (is_concrete<Base>
+    ? std::is_trivially_destructible_v<Base> : true)
+    && (true && ... && std::is_trivially_destructible_v<Derived>);
+
   template <typename T>
   struct TyNode {
     using Type = T;
@@ -228,10 +257,8 @@ namespace efl::H {
 
 namespace std {
   template <typename B, typename...DD>
-  void swap(efl::Poly<B, DD...>& L, efl::Poly<B, DD...>& R) {
-    efl::Poly<B, DD...> V = std::move(L);
-    L = std::move(R);
-    R = std::move(V);
+  void swap(efl::Poly<B, DD...>& L, efl::Poly<B, DD...>& R) noexcept {
+    L.swap(R);
   }
 } // namespace std
 
@@ -242,6 +269,7 @@ namespace efl {
     using BaseType = H::IPolyBase<Base, Derived...>;
     using SelfType = Poly<Base, Derived...>;
     using StorageType = H::PolyStorage<Base, Derived...>;
+    friend struct H::PolyAccess;
   private:
     template <typename T>
     static constexpr std::size_t ID
@@ -327,6 +355,17 @@ namespace efl {
 
     //=== Mutators ===//
 
+    /// Destroys the held object and constructs a `U` in place.
+    template <typename U, typename...Args>
+    requires(H::matches_any<U, Base, Derived...>
+      && H::is_concrete<U> && std::constructible_from<U, Args...>)
+    U& emplace(Args&&...args) {
+      this->destroySelf();
+      U* P = new (data_.raw_) U(POLY_FWD(args)...);
+      this->id_ = ID<U>;
+      return *P;
+    }
+
     ALWAYS_INLINE void visit(auto&& F) {
       if (this->isEmpty())
         return;
@@ -345,6 +384,20 @@ namespace efl {
         TAIL_RETURN visit_<Derived...>(POLY_FWD(F));
     }
 
+    /// Dispatches once and calls each of `Fs` with the active
+    /// alternative, in order.
+    ALWAYS_INLINE void visitFused(auto&&...Fs) {
+      this->visit([&Fs...] <typename T> (T* Ptr) {
+        ((void) Fs(Ptr), ...);
+      });
+    }
+
+    ALWAYS_INLINE void visitFused(auto&&...Fs) const {
+      this->visit([&Fs...] <typename T> (const T* Ptr) {
+        ((void) Fs(Ptr), ...);
+      });
+    }
+
     constexpr Base* operator->() {
       POLY_ASSERT(holdsAny());
       return getPtr();
@@ -355,6 +408,54 @@ namespace efl {
       return getPtr();
     }
 
+    /// Returns the held `T`, asserting it is active.
+    template <typename T>
+    requires(H::matches_any<T, Base, Derived...> && H::is_concrete<T>)
+    constexpr T& get() noexcept {
+      POLY_ASSERT(holdsType<T>());
+      return getUnchecked<T>();
+    }
+
+    template <typename T>
+    requires(H::matches_any<T, Base, Derived...> && H::is_concrete<T>)
+    constexpr const T& get() const noexcept {
+      POLY_ASSERT(holdsType<T>());
+      return getUnchecked<T>();
+    }
+
+    /// Returns the held `T` without checking. The active id is assumed,
+    /// so any checks done prior can be folded by the optimizer.
+    template <typename T>
+    requires(H::matches_any<T, Base, Derived...> && H::is_concrete<T>)
+    constexpr T& getUnchecked() noexcept {
+      POLY_ASSUME(this->id_ == ID<T>);
+      return *H::launder_cast<T>(data_.raw_);
+    }
+
+    template <typename T>
+    requires(H::matches_any<T, Base, Derived...> && H::is_concrete<T>)
+    constexpr const T& getUnchecked() const noexcept {
+      POLY_ASSUME(this->id_ == ID<T>);
+      return *H::launder_cast<const T>(data_.raw_);
+    }
+
+    /// Returns a pointer to the held `T`, or `nullptr` on mismatch.
+    template <typename T>
+    requires(H::matches_any<T, Base, Derived...> && H::is_concrete<T>)
+    constexpr T* getIf() noexcept {
+      if (!holdsType<T>())
+        return nullptr;
+      return &getUnchecked<T>();
+    }
+
+    template <typename T>
+    requires(H::matches_any<T, Base, Derived...> && H::is_concrete<T>)
+    constexpr const T* getIf() const noexcept {
+      if (!holdsType<T>())
+        return nullptr;
+      return &getUnchecked<T>();
+    }
+
     void erase() noexcept {
       destroySelf();
     }
@@ -363,8 +464,42 @@ namespace efl {
       return std::move(*this);
     }
 
-    void swap(Poly& R) {
-      std::swap(*this, R);
+    /// Exchanges in place. Matching alternatives are swapped directly,
+    /// trivially relocatable sets are swapped bytewise, and anything
+    /// else costs a single relocation through a stack buffer.
+    void swap(Poly& R) noexcept
+      requires H::all_movable<Derived...> {
+      if (this == &R)
+        return;
+      if constexpr (H::all_trivially_relocatable<Base, Derived...>) {
+        std::swap(this->data_.raw_, R.data_.raw_);
+        std::swap(this->id_, R.id_);
+      } else if (this->id_ == R.id_) {
+        this->visit([&R] <typename T> (T* P) {
+          using std::swap;
+          swap(*P, *H::launder_cast<T>(R.data_.raw_));
+        });
+      } else if (this->isEmpty()) {
+        R.relocateTo(*this);
+      } else if (R.isEmpty()) {
+        this->relocateTo(R);
+      } else {
+        this->visit([this, &R] <typename T> (T* P) {
+          alignas(T) std::uint8_t Buf[sizeof(T)];
+          T* Tmp = new (Buf) T{std::move(*P)};
+          P->~T();
+          this->id_ = 0U;
+          R.relocateTo(*this);
+          (void) new (R.data_.raw_) T{std::move(*Tmp)};
+          R.id_ = ID<T>;
+          Tmp->~T();
+        });
+      }
+    }
+
+    friend void swap(Poly& L, Poly& R) noexcept
+      requires H::all_movable<Derived...> {
+      L.swap(R);
     }
 
     //=== Observers ===//
@@ -388,6 +523,23 @@ namespace efl {
     constexpr bool isEmpty() const noexcept {
       return this->id_ == 0U;
     }
+
+    /// Returns the active alternative's id, or `0` when empty.
+    constexpr std::size_t typeId() const noexcept {
+      return this->id_;
+    }
+
+    /// Returns the id reported by `typeId()` while holding a `T`.
+    template <typename T>
+    requires H::matches_any<T, Base, Derived...>
+    static constexpr std::size_t IdOf() noexcept {
+      return ID<T>;
+    }
+
+    /// Returns the number of alternative ids, excluding empty.
+    static constexpr std::size_t Size() noexcept {
+      return sizeof...(Derived) + 1;
+    }
   
   protected:
     void destroySelf() noexcept {
@@ -395,12 +547,26 @@ namespace efl {
         (T* P) { P->~T(); });
       this->id_ = 0U;
     }
-  
-  private:
-    static constexpr std::size_t Size() noexcept {
-      return sizeof...(Derived) + 1;
+
+    /// Destroys the held `T` without dispatching on the id.
+    template <typename T>
+    void destroyAs() noexcept {
+      POLY_ASSERT(holdsType<T>());
+      H::launder_cast<T>(getPtr())->~T();
+      this->id_ = 0U;
     }
 
+    /// Moves the held object into `To`, which must be empty.
+    void relocateTo(Poly& To) noexcept {
+      POLY_ASSERT(To.isEmpty());
+      this->visit([&To] <typename T> (T* P) {
+        (void) new (To.data_.raw_) T{std::move(*P)};
+      });
+      To.id_ = this->id_;
+      this->destroySelf();
+    }
+  
+  private:
     constexpr const Base* getPtr() const noexcept {
       if (id_ == 0) [[unlikely]] {
         return nullptr;
@@ -450,10 +616,22 @@ namespace efl {
   };
 } // namespace efl
 
+namespace efl::H {
+  /// Typed access to `Poly` internals for the containers and
+  /// algorithms built on top of it.
+  struct PolyAccess {
+    template <typename T, typename P>
+    static void destroyAs(P& p) noexcept {
+      p.template destroyAs<T>();
+    }
+  };
+} // namespace efl::H
+
 #undef ALWAYS_INLINE
 #undef EMPTY_BASES
 #undef HINT_INLINE
 #undef POLY_ASSERT
+#undef POLY_ASSUME
 #undef POLY_FWD
 #undef TAIL_INLINE
 #undef TAIL_RETURN
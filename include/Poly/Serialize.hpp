@@ -0,0 +1,369 @@
+//===- Serialize.hpp ------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements a compact binary format for Poly values whose
+//  alternatives list their fields in `wire::Fields`. A record is the
+//  varint type id followed by each field: varints for unsigned values,
+//  zigzag varints for signed ones, fixed little-endian floats, and
+//  length-prefixed strings and vectors.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_SERIALIZE_HPP
+#define STANDALONE_POLY_SERIALIZE_HPP
+
+#include "Poly.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <ranges>
+#include <span>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace efl::wire {
+  /// Specialize with `static constexpr std::tuple List {&T::a, ...}`
+  /// for every non-empty alternative. Fields are written in order.
+  template <typename T> struct Fields;
+
+  /// Growable output buffer.
+  class Writer {
+  public:
+    void varint(std::uint64_t V) {
+      std::uint8_t* Out = this->grow(10);
+      std::size_t N = 0;
+      for (; V >= 0x80; V >>= 7)
+        Out[N++] = std::uint8_t(V | 0x80);
+      Out[N++] = std::uint8_t(V);
+      size_ += N;
+    }
+
+    void zigzag(std::int64_t V) {
+      this->varint((std::uint64_t(V) << 1) ^ std::uint64_t(V >> 63));
+    }
+
+    void bytes(const void* Data, std::size_t N) {
+      if (N != 0)
+        std::memcpy(this->grow(N), Data, N);
+      size_ += N;
+    }
+
+    template <typename F>
+    requires std::is_floating_point_v<F>
+    void fixed(F V) {
+      using U = std::conditional_t<sizeof(F) == 4,
+        std::uint32_t, std::uint64_t>;
+      const U Bits = std::bit_cast<U>(V);
+      std::uint8_t* Out = this->grow(sizeof(U));
+      for (std::size_t I = 0; I < sizeof(U); ++I)
+        Out[I] = std::uint8_t(Bits >> (8 * I));
+      size_ += sizeof(U);
+    }
+
+    std::span<const std::uint8_t> data() const noexcept {
+      return {buf_.data(), size_};
+    }
+    std::size_t size() const noexcept { return size_; }
+    void clear() noexcept { size_ = 0; }
+    void reserve(std::size_t N) {
+      if (N > buf_.size())
+        buf_.resize(N);
+    }
+
+  private:
+    /// Returns room for `N` more bytes without advancing.
+    std::uint8_t* grow(std::size_t N) {
+      if (buf_.size() - size_ < N) [[unlikely]]
+        buf_.resize(std::max(buf_.size() * 2, size_ + N + 64));
+      return buf_.data() + size_;
+    }
+
+    std::vector<std::uint8_t> buf_;
+    std::size_t size_ = 0;
+  };
+
+  /// Bounds-checked cursor over encoded bytes. Every read returns false
+  /// on truncated or malformed input.
+  class Reader {
+  public:
+    explicit Reader(std::span<const std::uint8_t> Bytes) noexcept
+     : pos_(Bytes.data()), end_(Bytes.data() + Bytes.size()) {}
+
+    bool varint(std::uint64_t& V) noexcept {
+      if (pos_ != end_ && *pos_ < 0x80) [[likely]] {
+        V = *pos_++;
+        return true;
+      }
+      V = 0;
+      for (unsigned Shift = 0; Shift < 64; Shift += 7) {
+        if (pos_ == end_)
+          return false;
+        const std::uint8_t B = *pos_++;
+        // The tenth byte holds only bit 63.
+        if (Shift == 63 && B > 1)
+          return false;
+        V |= std::uint64_t(B & 0x7F) << Shift;
+        if (B < 0x80)
+          return true;
+      }
+      return false;
+    }
+
+    bool zigzag(std::int64_t& V) noexcept {
+      std::uint64_t U;
+      if (!this->varint(U))
+        return false;
+      V = std::int64_t(U >> 1) ^ -std::int64_t(U & 1);
+      return true;
+    }
+
+    /// Returns the next `N` bytes, or null if fewer remain.
+    const std::uint8_t* take(std::size_t N) noexcept {
+      if (this->remaining() < N)
+        return nullptr;
+      const std::uint8_t* P = pos_;
+      pos_ += N;
+      return P;
+    }
+
+    template <typename F>
+    requires std::is_floating_point_v<F>
+    bool fixed(F& V) noexcept {
+      using U = std::conditional_t<sizeof(F) == 4,
+        std::uint32_t, std::uint64_t>;
+      const std::uint8_t* P = this->take(sizeof(U));
+      if (!P)
+        return false;
+      U Bits = 0;
+      for (std::size_t I = 0; I < sizeof(U); ++I)
+        Bits |= U(P[I]) << (8 * I);
+      V = std::bit_cast<F>(Bits);
+      return true;
+    }
+
+    std::size_t remaining() const noexcept {
+      return std::size_t(end_ - pos_);
+    }
+    bool atEnd() const noexcept { return pos_ == end_; }
+
+  private:
+    const std::uint8_t* pos_;
+    const std::uint8_t* end_;
+  };
+} // namespace efl::wire
+
+namespace efl::H {
+  template <typename T>
+  concept has_wire_fields = requires { wire::Fields<T>::List; };
+
+  template <typename T>
+  concept wire_record = has_wire_fields<T> || std::is_empty_v<T>;
+
+  template <typename T> struct IsVector : std::false_type {};
+  template <typename T, typename A>
+  struct IsVector<std::vector<T, A>> : std::true_type {};
+
+  /// Vectors of floats travel as one blob on little-endian hosts.
+  template <typename T>
+  concept wire_blob = std::is_floating_point_v<T>
+    && std::endian::native == std::endian::little;
+
+  template <typename T>
+  void writeValue(wire::Writer& W, const T& V) {
+    if constexpr (std::same_as<T, bool>) {
+      const std::uint8_t B = V;
+      W.bytes(&B, 1);
+    } else if constexpr (std::is_enum_v<T>) {
+      writeValue(W, std::underlying_type_t<T>(V));
+    } else if constexpr (std::unsigned_integral<T>) {
+      W.varint(V);
+    } else if constexpr (std::signed_integral<T>) {
+      W.zigzag(V);
+    } else if constexpr (std::is_floating_point_v<T>) {
+      W.fixed(V);
+    } else if constexpr (std::same_as<T, std::string>) {
+      W.varint(V.size());
+      W.bytes(V.data(), V.size());
+    } else if constexpr (IsVector<T>::value) {
+      using E = typename T::value_type;
+      W.varint(V.size());
+      if constexpr (wire_blob<E>) {
+        W.bytes(V.data(), V.size() * sizeof(E));
+      } else {
+        for (const E& X : V)
+          writeValue(W, X);
+      }
+    } else {
+      static_assert(wire_record<T>, "wire::Fields<T> is not specialized");
+      if constexpr (has_wire_fields<T>) {
+        std::apply([&] (auto...Ptrs) {
+          (writeValue(W, V.*Ptrs), ...);
+        }, wire::Fields<T>::List);
+      }
+    }
+  }
+
+  template <typename T>
+  bool readValue(wire::Reader& R, T& V) {
+    if constexpr (std::same_as<T, bool>) {
+      const std::uint8_t* B = R.take(1);
+      if (!B || *B > 1)
+        return false;
+      V = *B;
+      return true;
+    } else if constexpr (std::is_enum_v<T>) {
+      std::underlying_type_t<T> U;
+      if (!readValue(R, U))
+        return false;
+      V = T(U);
+      return true;
+    } else if constexpr (std::unsigned_integral<T>) {
+      std::uint64_t U;
+      if (!R.varint(U) || U > std::numeric_limits<T>::max())
+        return false;
+      V = T(U);
+      return true;
+    } else if constexpr (std::signed_integral<T>) {
+      std::int64_t S;
+      if (!R.zigzag(S) || S < std::numeric_limits<T>::min()
+          || S > std::numeric_limits<T>::max())
+        return false;
+      V = T(S);
+      return true;
+    } else if constexpr (std::is_floating_point_v<T>) {
+      return R.fixed(V);
+    } else if constexpr (std::same_as<T, std::string>) {
+      std::uint64_t N;
+      const std::uint8_t* P;
+      if (!R.varint(N) || !(P = R.take(N)))
+        return false;
+      V.assign(reinterpret_cast<const char*>(P), N);
+      return true;
+    } else if constexpr (IsVector<T>::value) {
+      using E = typename T::value_type;
+      std::uint64_t N;
+      // Each element takes at least one byte, which bounds `N`.
+      if (!R.varint(N) || N > R.remaining())
+        return false;
+      if constexpr (wire_blob<E>) {
+        const std::uint8_t* P = R.take(N * sizeof(E));
+        if (!P)
+          return false;
+        V.resize(N);
+        if (N != 0)
+          std::memcpy(V.data(), P, N * sizeof(E));
+      } else {
+        V.resize(N);
+        for (E& X : V) {
+          if (!readValue(R, X))
+            return false;
+        }
+      }
+      return true;
+    } else {
+      static_assert(wire_record<T>, "wire::Fields<T> is not specialized");
+      if constexpr (has_wire_fields<T>) {
+        return std::apply([&] (auto...Ptrs) {
+          return (true && ... && readValue(R, V.*Ptrs));
+        }, wire::Fields<T>::List);
+      } else {
+        return true;
+      }
+    }
+  }
+
+  template <typename P, typename T>
+  bool decodeAs(wire::Reader& R, P& Out) {
+    if (!readValue(R, Out.template emplace<T>())) {
+      Out.erase();
+      return false;
+    }
+    return true;
+  }
+
+  template <typename P, typename T>
+  constexpr auto decoderOf() -> bool(*)(wire::Reader&, P&) {
+    if constexpr (is_concrete<T>)
+      return &decodeAs<P, T>;
+    else
+      return nullptr;
+  }
+} // namespace efl::H
+
+namespace efl::wire {
+  /// Appends one record: the type id, then the fields of the held
+  /// alternative. An empty `Poly` is the single byte 0.
+  template <typename Base, H::wire_record...Derived>
+  void encode(Writer& W, const Poly<Base, Derived...>& P) {
+    W.varint(P.typeId());
+    P.visit([&W] <typename T> (const T* V) {
+      H::writeValue(W, *V);
+    });
+  }
+
+  /// Reads one record into `Out`, constructing the alternative in place
+  /// with `emplace` and filling its fields. On failure `Out` is empty.
+  template <typename Base, H::wire_record...Derived>
+  requires(std::default_initializable<Derived> && ...)
+  bool decode(Reader& R, Poly<Base, Derived...>& Out) {
+    using P = Poly<Base, Derived...>;
+    using Fn = bool(*)(Reader&, P&);
+    static constexpr Fn Table[] {
+      nullptr, H::decoderOf<P, Base>(), H::decoderOf<P, Derived>()...
+    };
+    std::uint64_t Id;
+    Out.erase();
+    if (!R.varint(Id) || Id >= std::size(Table))
+      return false;
+    return Id == 0 || (Table[Id] && Table[Id](R, Out));
+  }
+
+  /// Appends the element count followed by each record.
+  template <std::ranges::contiguous_range R>
+  requires H::is_poly<std::ranges::range_value_t<R>>
+  void encodeAll(Writer& W, R&& Range) {
+    const auto N = std::size_t(std::ranges::size(Range));
+    W.reserve(W.size() + N * 2 + 10);
+    W.varint(N);
+    for (const auto& P : Range)
+      wire::encode(W, P);
+  }
+
+  /// Appends the records written by `encodeAll` to `Out`. On failure
+  /// the elements decoded so far are kept.
+  template <typename Base, H::wire_record...Derived>
+  bool decodeAll(Reader& R, std::vector<Poly<Base, Derived...>>& Out) {
+    std::uint64_t N;
+    if (!R.varint(N) || N > R.remaining())
+      return false;
+    Out.reserve(Out.size() + N);
+    for (std::uint64_t I = 0; I < N; ++I) {
+      if (!wire::decode(R, Out.emplace_back())) {
+        Out.pop_back();
+        return false;
+      }
+    }
+    return true;
+  }
+} // namespace efl::wire
+
+#endif // STANDALONE_POLY_SERIALIZE_HPP
@@ -0,0 +1,276 @@
+//===- SmallVector.hpp ----------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements a vector of Poly objects with inline storage
+//  for the first N elements. Growth relocates elements to the heap:
+//  bytewise when every alternative is trivially copyable, and with
+//  move-and-destroy otherwise.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_SMALLVECTOR_HPP
+#define STANDALONE_POLY_SMALLVECTOR_HPP
+
+#include "Poly.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+namespace efl {
+  /// A `std::vector<Poly<Base, Derived...>>` that stores up to `N`
+  /// elements without allocating. Iterators and references are
+  /// invalidated by growth and by moving the container.
+  template <std::size_t N, typename Base,
+    std::derived_from<Base>...Derived>
+  requires(N > 0)
+  class SmallPolyVector {
+  public:
+    using value_type = Poly<Base, Derived...>;
+    using size_type = std::size_t;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+    using iterator = value_type*;
+    using const_iterator = const value_type*;
+
+  private:
+    static constexpr bool Trivial =
+      H::all_trivially_relocatable<Base, Derived...>;
+    static constexpr bool TrivialDestroy =
+      H::all_trivially_destructible<Base, Derived...>;
+
+  public:
+    SmallPolyVector() noexcept = default;
+
+    SmallPolyVector(const SmallPolyVector& R)
+      requires H::all_copyable<Derived...> {
+      try {
+        this->append(R.begin(), R.end());
+      } catch (...) {
+        this->destroy(data_, size_);
+        this->release();
+        throw;
+      }
+    }
+
+    SmallPolyVector(SmallPolyVector&& R) noexcept
+      requires H::all_movable<Derived...> {
+      this->take(R);
+    }
+
+    /// Provides the basic guarantee: if a copy throws, this holds a
+    /// prefix of `R`.
+    SmallPolyVector& operator=(const SmallPolyVector& R)
+      requires H::all_copyable<Derived...> {
+      if (this != &R) {
+        this->clear();
+        this->append(R.begin(), R.end());
+      }
+      return *this;
+    }
+
+    SmallPolyVector& operator=(SmallPolyVector&& R) noexcept
+      requires H::all_movable<Derived...> {
+      if (this != &R) {
+        this->clear();
+        this->release();
+        this->take(R);
+      }
+      return *this;
+    }
+
+    ~SmallPolyVector() {
+      this->destroy(data_, size_);
+      this->release();
+    }
+
+    //=== Element Access ===//
+
+    value_type& operator[](std::size_t I) noexcept {
+      assert(I < size_);
+      return data_[I];
+    }
+    const value_type& operator[](std::size_t I) const noexcept {
+      assert(I < size_);
+      return data_[I];
+    }
+
+    value_type& front() noexcept { return (*this)[0]; }
+    const value_type& front() const noexcept { return (*this)[0]; }
+    value_type& back() noexcept { return (*this)[size_ - 1]; }
+    const value_type& back() const noexcept { return (*this)[size_ - 1]; }
+
+    value_type* data() noexcept { return data_; }
+    const value_type* data() const noexcept { return data_; }
+
+    iterator begin() noexcept { return data_; }
+    iterator end() noexcept { return data_ + size_; }
+    const_iterator begin() const noexcept { return data_; }
+    const_iterator end() const noexcept { return data_ + size_; }
+
+    //=== Modifiers ===//
+
+    /// Constructs a `Poly` from `args` at the end. `args` may refer to
+    /// elements of this vector.
+    template <typename...Args>
+    value_type& emplace_back(Args&&...args) {
+      if (size_ == capacity_) [[unlikely]]
+        return this->growAndEmplace(std::forward<Args>(args)...);
+      value_type* P = new (data_ + size_)
+        value_type(std::forward<Args>(args)...);
+      ++size_;
+      return *P;
+    }
+
+    void push_back(const value_type& V) { (void) this->emplace_back(V); }
+    void push_back(value_type&& V) {
+      (void) this->emplace_back(std::move(V));
+    }
+
+    void pop_back() noexcept {
+      assert(size_ > 0);
+      this->destroy(data_ + --size_, 1);
+    }
+
+    /// Destroys every element. Heap storage is kept.
+    void clear() noexcept {
+      this->destroy(data_, size_);
+      size_ = 0;
+    }
+
+    void reserve(std::size_t Cap) {
+      if (Cap > capacity_)
+        this->relocateTo(this->allocate(Cap), Cap);
+    }
+
+    //=== Observers ===//
+
+    std::size_t size() const noexcept { return size_; }
+    std::size_t capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return size_ == 0; }
+    bool isInline() const noexcept { return data_ == this->inlineData(); }
+    static constexpr std::size_t InlineCapacity() noexcept { return N; }
+
+  private:
+    value_type* inlineData() noexcept {
+      return reinterpret_cast<value_type*>(inline_);
+    }
+    const value_type* inlineData() const noexcept {
+      return reinterpret_cast<const value_type*>(inline_);
+    }
+
+    static value_type* allocate(std::size_t Cap) {
+      return std::allocator<value_type>().allocate(Cap);
+    }
+
+    void release() noexcept {
+      if (!this->isInline())
+        std::allocator<value_type>().deallocate(data_, capacity_);
+      data_ = this->inlineData();
+      capacity_ = N;
+    }
+
+    static void destroy(value_type* P, std::size_t Count) noexcept {
+      if constexpr (!TrivialDestroy) {
+        for (std::size_t I = 0; I < Count; ++I)
+          P[I].~value_type();
+      }
+    }
+
+    /// Moves `Count` elements from `From` into uninitialized `To` and
+    /// ends their lifetimes in `From`.
+    static void relocate(value_type* From, std::size_t Count,
+                         value_type* To) noexcept {
+      if constexpr (Trivial) {
+        if (Count != 0)
+          std::memcpy(static_cast<void*>(To), From,
+            Count * sizeof(value_type));
+      } else {
+        for (std::size_t I = 0; I < Count; ++I) {
+          (void) new (To + I) value_type(std::move(From[I]));
+          From[I].~value_type();
+        }
+      }
+    }
+
+    void relocateTo(value_type* Storage, std::size_t Cap) noexcept {
+      relocate(data_, size_, Storage);
+      const std::size_t Size = size_;
+      this->release();
+      data_ = Storage;
+      capacity_ = Cap;
+      size_ = Size;
+    }
+
+    /// Builds the new element in the new storage before relocating, so
+    /// arguments referring into the old storage stay valid.
+    template <typename...Args>
+    value_type& growAndEmplace(Args&&...args) {
+      const std::size_t Cap = std::max(capacity_ * 2, size_ + 1);
+      value_type* Storage = this->allocate(Cap);
+      value_type* P;
+      try {
+        P = new (Storage + size_) value_type(std::forward<Args>(args)...);
+      } catch (...) {
+        std::allocator<value_type>().deallocate(Storage, Cap);
+        throw;
+      }
+      this->relocateTo(Storage, Cap);
+      ++size_;
+      return *P;
+    }
+
+    template <typename It>
+    void append(It First, It Last) {
+      const auto Count = std::size_t(Last - First);
+      this->reserve(size_ + Count);
+      if constexpr (Trivial) {
+        if (Count != 0)
+          std::memcpy(static_cast<void*>(data_ + size_), &*First,
+            Count * sizeof(value_type));
+        size_ += Count;
+      } else {
+        for (; First != Last; ++First, ++size_)
+          (void) new (data_ + size_) value_type(*First);
+      }
+    }
+
+    /// Takes the contents of `R`, which is left empty and inline. This
+    /// must have no elements and inline storage.
+    void take(SmallPolyVector& R) noexcept {
+      if (R.isInline()) {
+        relocate(R.data_, R.size_, data_);
+      } else {
+        data_ = R.data_;
+        capacity_ = R.capacity_;
+        R.data_ = R.inlineData();
+        R.capacity_ = N;
+      }
+      size_ = std::exchange(R.size_, 0);
+    }
+
+    value_type* data_ = this->inlineData();
+    std::size_t size_ = 0, capacity_ = N;
+    alignas(value_type) std::byte inline_[N * sizeof(value_type)];
+  };
+} // namespace efl
+
+#endif // STANDALONE_POLY_SMALLVECTOR_HPP
@@ -0,0 +1,301 @@
+//===- TieredVector.hpp ---------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements a vector of Poly objects that keeps a bounded
+//  set of pages in memory and spills the rest to a file-backed mapping.
+//  Resident pages are replaced with CLOCK over per-frame access bits;
+//  misses hint the kernel to read the following pages ahead.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_TIEREDVECTOR_HPP
+#define STANDALONE_POLY_TIEREDVECTOR_HPP
+
+#include "Poly.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace efl {
+  /// A `std::vector`-like container of `Poly<Base, Derived...>` whose
+  /// cold pages live in a file. At most `ResidentBytes` of pages are
+  /// held in memory. A reference stays valid until the next access that
+  /// misses; mutable access marks the page dirty. Not thread-safe.
+  template <typename Base, std::derived_from<Base>...Derived>
+  requires H::all_trivially_relocatable<Base, Derived...>
+  class TieredPolyVector {
+    static constexpr std::uint32_t NoFrame = ~std::uint32_t(0);
+  public:
+    using value_type = Poly<Base, Derived...>;
+    using size_type = std::size_t;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+
+    static constexpr std::size_t PageBytes = std::size_t(16) << 10;
+    static constexpr std::size_t PageSize = PageBytes / sizeof(value_type);
+    static_assert(PageSize > 0, "Poly is larger than a page!");
+
+    /// `Path` names a scratch file. It is unlinked once opened, so its
+    /// space is released with the container. `MaxBytes` bounds the
+    /// address space reserved for the cold tier.
+    TieredPolyVector(const char* Path, std::size_t ResidentBytes,
+                     std::size_t MaxBytes = std::size_t(1) << 40)
+     : maxPages_(MaxBytes / PageBytes) {
+      fd_ = ::open(Path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+      if (fd_ < 0)
+        throw std::system_error(errno, std::generic_category(), Path);
+      (void) ::unlink(Path);
+      void* M = ::mmap(nullptr, maxPages_ * PageBytes,
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+      if (M == MAP_FAILED) {
+        ::close(fd_);
+        throw std::system_error(errno, std::generic_category(), "mmap");
+      }
+      cold_ = static_cast<std::byte*>(M);
+      const std::size_t Frames =
+        std::max<std::size_t>(2, ResidentBytes / PageBytes);
+      try {
+        hot_.reset(static_cast<std::byte*>(
+          ::operator new(Frames * PageBytes, HotAlign)));
+        frames_.resize(Frames);
+      } catch (...) {
+        ::munmap(cold_, maxPages_ * PageBytes);
+        ::close(fd_);
+        throw;
+      }
+    }
+
+    TieredPolyVector(const TieredPolyVector&) = delete;
+    TieredPolyVector& operator=(const TieredPolyVector&) = delete;
+
+    ~TieredPolyVector() {
+      ::munmap(cold_, maxPages_ * PageBytes);
+      ::close(fd_);
+    }
+
+    //=== Element Access ===//
+
+    value_type& operator[](std::size_t I) {
+      Frame& F = frames_[this->frameFor(I / PageSize)];
+      F.dirty = true;
+      return this->slot(F, I);
+    }
+
+    const value_type& operator[](std::size_t I) const {
+      return this->slot(frames_[this->frameFor(I / PageSize)], I);
+    }
+
+    value_type& back() { return (*this)[size_ - 1]; }
+
+    //=== Modifiers ===//
+
+    /// Constructs a `Poly` from `args` at the end. `args` may refer to
+    /// elements of this vector; the value is built before any page is
+    /// evicted.
+    template <typename...Args>
+    value_type& emplace_back(Args&&...args) {
+      value_type V(std::forward<Args>(args)...);
+      const std::size_t Page = size_ / PageSize;
+      if (Page == frameOf_.size())
+        this->addPage();
+      Frame& F = frames_[this->frameFor(Page)];
+      F.dirty = true;
+      value_type* P = new (&this->slot(F, size_)) value_type(std::move(V));
+      ++size_;
+      return *P;
+    }
+
+    void push_back(const value_type& V) { (void) this->emplace_back(V); }
+    void push_back(value_type&& V) {
+      (void) this->emplace_back(std::move(V));
+    }
+
+    /// Drops every element; the file keeps its size for reuse.
+    void clear() noexcept { size_ = 0; }
+
+    //=== Observers ===//
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    std::size_t residentBytes() const noexcept {
+      return frames_.size() * PageBytes;
+    }
+    std::size_t misses() const noexcept { return misses_; }
+    std::size_t writebacks() const noexcept { return writebacks_; }
+
+    /// Asks the kernel to start reading the cold pages of `[First, Last)`
+    /// in the background. Returns immediately.
+    void prefetch(std::size_t First, std::size_t Last) const {
+      if (First >= Last)
+        return;
+      const std::size_t P0 = First / PageSize;
+      const std::size_t P1 = std::min((Last - 1) / PageSize + 1,
+        frameOf_.size());
+      if (P0 < P1)
+        (void) ::madvise(cold_ + P0 * PageBytes, (P1 - P0) * PageBytes,
+          MADV_WILLNEED);
+    }
+
+    //=== Iterators ===//
+
+    template <bool Const>
+    class Iterator {
+      using Owner = std::conditional_t<Const,
+        const TieredPolyVector, TieredPolyVector>;
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = TieredPolyVector::value_type;
+      using difference_type = std::ptrdiff_t;
+      using reference = std::conditional_t<Const,
+        const value_type&, value_type&>;
+
+      Iterator() = default;
+      Iterator(Owner* V, std::size_t I) : vec_(V), index_(I) {}
+
+      reference operator*() const { return (*vec_)[index_]; }
+      Iterator& operator++() {
+        ++index_;
+        return *this;
+      }
+      Iterator operator++(int) {
+        Iterator R = *this;
+        ++index_;
+        return R;
+      }
+      bool operator==(const Iterator& R) const { return index_ == R.index_; }
+
+    private:
+      Owner* vec_ = nullptr;
+      std::size_t index_ = 0;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, size_}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size_}; }
+
+  private:
+    struct Frame {
+      std::uint32_t page = NoFrame;
+      bool referenced = false;
+      bool dirty = false;
+    };
+
+    static constexpr std::align_val_t HotAlign {alignof(value_type)};
+
+    struct HotDelete {
+      void operator()(std::byte* P) const noexcept {
+        ::operator delete(P, HotAlign);
+      }
+    };
+
+    /// Pages read ahead after a sequential miss.
+    static constexpr std::size_t Readahead = 8;
+
+    value_type& slot(const Frame& F, std::size_t I) const {
+      const std::size_t Index = std::size_t(&F - frames_.data());
+      auto* Page = reinterpret_cast<value_type*>(
+        hot_.get() + Index * PageBytes);
+      return *std::launder(Page + I % PageSize);
+    }
+
+    std::uint32_t frameFor(std::size_t Page) const {
+      std::uint32_t F = frameOf_[Page];
+      if (F == NoFrame) [[unlikely]]
+        F = this->pageIn(Page);
+      frames_[F].referenced = true;
+      return F;
+    }
+
+    /// Picks a victim with CLOCK, writes it back if dirty and loads
+    /// `Page` into its frame.
+    std::uint32_t pageIn(std::size_t Page) const {
+      ++misses_;
+      for (;; hand_ = (hand_ + 1) % frames_.size()) {
+        Frame& F = frames_[hand_];
+        if (!F.referenced)
+          break;
+        F.referenced = false;
+      }
+      const auto Index = std::uint32_t(hand_);
+      hand_ = (hand_ + 1) % frames_.size();
+      Frame& F = frames_[Index];
+      std::byte* Hot = hot_.get() + Index * PageBytes;
+      if (F.page != NoFrame) {
+        if (F.dirty) {
+          std::memcpy(cold_ + std::size_t(F.page) * PageBytes, Hot,
+            PageBytes);
+          ++writebacks_;
+        }
+        frameOf_[F.page] = NoFrame;
+      }
+      std::memcpy(Hot, cold_ + Page * PageBytes, PageBytes);
+      F = {std::uint32_t(Page), false, false};
+      frameOf_[Page] = Index;
+
+      // Read ahead only when misses look sequential.
+      const bool Sequential = Page == lastMiss_ + 1;
+      lastMiss_ = Page;
+      const std::size_t Ahead = std::min(Page + 1 + Readahead,
+        frameOf_.size());
+      if (Sequential && Page + 1 < Ahead)
+        (void) ::madvise(cold_ + (Page + 1) * PageBytes,
+          (Ahead - Page - 1) * PageBytes, MADV_WILLNEED);
+      return Index;
+    }
+
+    void addPage() {
+      const std::size_t Page = frameOf_.size();
+      if (Page == maxPages_)
+        throw std::bad_alloc();
+      if (Page == filePages_) {
+        filePages_ = std::min(maxPages_,
+          std::max<std::size_t>(16, filePages_ * 2));
+        if (::ftruncate(fd_, off_t(filePages_ * PageBytes)) != 0)
+          throw std::system_error(errno, std::generic_category(),
+            "ftruncate");
+      }
+      frameOf_.push_back(NoFrame);
+    }
+
+    int fd_ = -1;
+    std::byte* cold_ = nullptr;
+    std::size_t maxPages_, filePages_ = 0, size_ = 0;
+    std::unique_ptr<std::byte[], HotDelete> hot_;
+    mutable std::vector<Frame> frames_;
+    mutable std::vector<std::uint32_t> frameOf_;
+    mutable std::size_t hand_ = 0, lastMiss_ = ~std::size_t(0);
+    mutable std::size_t misses_ = 0, writebacks_ = 0;
+  };
+} // namespace efl
+
+#endif // STANDALONE_POLY_TIEREDVECTOR_HPP
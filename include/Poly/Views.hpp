@@ -0,0 +1,133 @@
+//===- Views.hpp ----------------------------------------------------===//
+//
+// Copyright (C) 2024 Eightfold
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+//     limitations under the License.
+//
+//===----------------------------------------------------------------===//
+//
+//  This file implements range adaptors over ranges of Poly objects.
+//  Each element is dispatched on exactly once.
+//
+//===----------------------------------------------------------------===//
+
+#pragma once
+
+#ifndef STANDALONE_POLY_VIEWS_HPP
+#define STANDALONE_POLY_VIEWS_HPP
+
+#include "Poly.hpp"
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <type_traits>
+
+namespace efl::H {
+  template <typename F, template <typename> class Q, typename...TT>
+  using VisitResultT = std::common_reference_t<
+    std::invoke_result_t<const F&, Q<TT>*>...>;
+
+  template <typename F, typename P>
+  struct PolyVisitResult;
+
+  template <typename F, typename B, typename...DD>
+  struct PolyVisitResult<F, Poly<B, DD...>> {
+    using Type = VisitResultT<F, std::type_identity_t, DD...>;
+  };
+
+  template <typename F, typename B, typename...DD>
+  requires is_concrete<B>
+  struct PolyVisitResult<F, Poly<B, DD...>> {
+    using Type = VisitResultT<F, std::type_identity_t, B, DD...>;
+  };
+
+  template <typename F, typename B, typename...DD>
+  struct PolyVisitResult<F, const Poly<B, DD...>> {
+    using Type = VisitResultT<F, std::add_const_t, DD...>;
+  };
+
+  template <typename F, typename B, typename...DD>
+  requires is_concrete<B>
+  struct PolyVisitResult<F, const Poly<B, DD...>> {
+    using Type = VisitResultT<F, std::add_const_t, B, DD...>;
+  };
+
+  /// Visits a non-empty `P`, returning the common result of `Fn`.
+  /// References are returned as references.
+  template <typename P, typename F>
+  constexpr auto visitReturn(P& p, const F& Fn)
+   -> typename PolyVisitResult<F, P>::Type {
+    using R = typename PolyVisitResult<F, P>::Type;
+    assert(p.holdsAny());
+    if constexpr (std::is_void_v<R>) {
+      p.visit([&Fn] <typename T> (T* Ptr) {
+        (void) std::invoke(Fn, Ptr);
+      });
+    } else if constexpr (std::is_reference_v<R>) {
+      std::remove_reference_t<R>* Out = nullptr;
+      p.visit([&Out, &Fn] <typename T> (T* Ptr) {
+        R Ref = std::invoke(Fn, Ptr);
+        Out = std::addressof(Ref);
+      });
+      return static_cast<R>(*Out);
+    } else {
+      std::optional<R> Out;
+      p.visit([&Out, &Fn] <typename T> (T* Ptr) {
+        Out.emplace(std::invoke(Fn, Ptr));
+      });
+      return std::move(*Out);
+    }
+  }
+} // namespace efl::H
+
+namespace efl::views {
+  /// Yields `T&` for every element holding a `T`. The id is compared
+  /// once by the filter; the access afterwards is unchecked.
+  template <typename T>
+  inline constexpr auto of_type
+    = std::views::filter([] (const auto& P) {
+        return P.template holdsType<T>();
+      })
+    | std::views::transform([] (auto& P) -> decltype(auto) {
+        return P.template getUnchecked<T>();
+      });
+
+  /// Lazily maps every non-empty element through `Fn`, which is
+  /// invoked with a pointer to the active alternative. Empty elements
+  /// are skipped.
+  template <typename F>
+  constexpr auto visit(F&& Fn) {
+    return std::views::filter([] (const auto& P) {
+        return P.holdsAny();
+      })
+    | std::views::transform(
+      [Fn = std::forward<F>(Fn)] (auto& P) -> decltype(auto) {
+        return H::visitReturn(P, Fn);
+      });
+  }
+} // namespace efl::views
+
+namespace efl {
+  /// Runs every pass in `Fs` over `R` in a single traversal. Each
+  /// element is dispatched on once and the passes are applied to it in
+  /// order. Empty elements are skipped.
+  template <std::ranges::input_range R, typename...F>
+  constexpr void visitFused(R&& Range, F&&...Fs) {
+    for (auto&& P : Range)
+      P.visitFused(Fs...);
+  }
+} // namespace efl
+
+#endif // STANDALONE_POLY_VIEWS_HPP